@@ -1,6 +1,7 @@
 #include "log.hpp"
 #include "app.hpp"
 #include "gui.hpp"
+#include "profiler.hpp"
 #include "settings_view.hpp"
 #include <android/asset_manager.h>
 #include <android/asset_manager_jni.h>
@@ -21,6 +22,10 @@ oboe::AudioStream* g_stream;
 struct Callback : oboe::AudioStreamCallback {
     oboe::DataCallbackResult onAudioReady(oboe::AudioStream* oboeStream, void* audioData, int32_t numFrames) override {
         app::audio_callback((int16_t*) audioData, numFrames);
+        if (profiler::enabled()) {
+            oboe::ResultWithValue<int32_t> xruns = oboeStream->getXRunCount();
+            if (xruns) profiler::audio_underruns(xruns.value());
+        }
         return oboe::DataCallbackResult::Continue;
     }
 
@@ -101,20 +106,22 @@ bool start_audio() {
 namespace platform {
 
 
-bool load_asset(std::string const& name, std::vector<uint8_t>& buf) {
+bool load_asset(std::string const& name, Asset& asset) {
     AAsset* ad = AAssetManager_open(g_asset_manager, name.c_str(), AASSET_MODE_BUFFER);
     if (!ad) {
         LOGE("load_asset: could not open %s", name.c_str());
         return false;
     }
-    buf.resize(AAsset_getLength(ad));
-    int len = AAsset_read(ad, buf.data(), buf.size());
-    AAsset_close(ad);
-    if (len != buf.size()) {
+    // uncompressed assets are mapped straight from the APK
+    void const* buf = AAsset_getBuffer(ad);
+    if (!buf) {
+        AAsset_close(ad);
         LOGE("load_asset: could not open %s", name.c_str());
         return false;
     }
-
+    asset.data  = (uint8_t const*) buf;
+    asset.size  = AAsset_getLength(ad);
+    asset.owner = std::shared_ptr<void>(ad, [](void* p) { AAsset_close((AAsset*) p); });
     return true;
 }
 
@@ -202,9 +209,10 @@ extern "C" {
         g_env = env;
         app::set_insets(topInset, bottomInset);
     }
-    JNIEXPORT void JNICALL Java_com_twobit_gtmobile_Native_draw(JNIEnv* env, jclass) {
+    JNIEXPORT jint JNICALL Java_com_twobit_gtmobile_Native_draw(JNIEnv* env, jclass) {
         g_env = env;
         app::draw();
+        return app::frame_timeout();
     }
     JNIEXPORT void JNICALL Java_com_twobit_gtmobile_Native_touch(JNIEnv* env, jclass, jint x, jint y, jint action) {
         g_env = env;
@@ -262,6 +270,7 @@ extern "C" {
         env->GetByteArrayRegion(data, offset, 3, (jbyte*) event.data());
         std::lock_guard<std::mutex> lock(g_midi_queue_mutex);
         g_midi_event_queue.push(event);
+        app::request_redraw();
     }
 
 }
@@ -183,6 +183,7 @@ public class MainActivity extends Activity {
                 @Override
                 public void onSend(byte[] data, int offset, int count, long timestamp) throws IOException {
                     Native.onMidiEvent(data, offset, count);
+                    mView.requestRender();
                 }
             });
         }, null);
@@ -317,6 +318,7 @@ public class MainActivity extends Activity {
         mView.queueEvent(() -> {
             Native.key(code, e.getUnicodeChar());
         });
+        mView.requestRender();
         return false;
     }
 }
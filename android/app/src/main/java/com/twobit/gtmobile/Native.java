@@ -10,7 +10,7 @@ class Native {
     public static native void free();
     public static native void resize(int width, int height);
     public static native void setInsets(int topInset, int bottomInset);
-    public static native void draw();
+    public static native int draw(); // returns milliseconds until the next frame is due
     public static native void touch(int x, int y, int action);
     public static native void key(int key, int unicode);
     public static native void importSong(String path);
@@ -50,11 +50,18 @@ public class View extends GLSurfaceView {
             }
             @Override
             public void onDrawFrame(GL10 gl) {
-                Native.draw();
+                int timeout = Native.draw();
+                removeCallbacks(mRender);
+                if (timeout == 0) requestRender();
+                else postDelayed(mRender, timeout);
             }
         });
+        // frames are scheduled by the app, and by input
+        setRenderMode(RENDERMODE_WHEN_DIRTY);
     }
 
+    final Runnable mRender = this::requestRender;
+
 
     int     mTouchId;
     boolean mTouchPressed;
@@ -104,6 +111,7 @@ public class View extends GLSurfaceView {
                 Native.touch(x, y, a);
             }
         });
+        requestRender();
         return true;
     }
 
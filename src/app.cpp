@@ -6,14 +6,22 @@
 #include "gui.hpp"
 #include "instrument_manager_view.hpp"
 #include "instrument_view.hpp"
+#include "jobs.hpp"
 #include "log.hpp"
 #include "piano.hpp"
+#include "profiler.hpp"
 #include "project_view.hpp"
 #include "settings_view.hpp"
 #include "sid.hpp"
+#include "song_index.hpp"
+#include "song_journal.hpp"
 #include "song_view.hpp"
 #include "song_undo.hpp"
+#include "song_version.hpp"
+#include "table_space.hpp"
 
+#include <atomic>
+#include <chrono>
 #include <cstddef>
 #include <cstring>
 #include <fstream>
@@ -24,6 +32,17 @@
 namespace app {
 namespace {
 
+enum {
+    // the immediate mode gui may need a few frames to settle after a change
+    SETTLE_FRAMES = 3,
+    // while playing, redraw when the row changes, else at this rate
+    PLAYBACK_FPS = 30,
+    // upper bound for sleeping while nothing happens
+    IDLE_TIMEOUT_MS = 500,
+    // finished jobs can't wake up the platform's wait, so poll for them
+    JOB_POLL_MS = 50,
+};
+
 enum class View {
     Splash,
     Project,
@@ -53,9 +72,28 @@ View            g_view        = View::Splash;
 bool            g_initialized = false;
 std::string     g_storage_dir = ".";
 Mixer           g_mixer(g_player, g_sid);
+jobs::Handle    g_seek_job;
 bool            g_take_screenshot = false;
 std::string     g_import_song_path;
 
+std::atomic<bool> g_redraw_requested{ true };
+int               g_settle_frames;
+
+using Clock = std::chrono::steady_clock;
+Clock::time_point        g_last_draw_time;
+std::array<int, 3>       g_drawn_song_pos;
+std::array<int, 3>       g_drawn_patt_pos;
+
+
+// all input that needs a response within a display refresh
+bool needs_full_rate() {
+    return g_settle_frames > 0 || gui::touch::pressed() || gui::input_text_active();
+}
+
+int ms_since_last_draw() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - g_last_draw_time).count();
+}
+
 
 void setup_canvas() {
     int width  = gfx::screen_size().x;
@@ -91,6 +129,56 @@ void setup_canvas() {
 }
 
 
+// Start playback at the order position with the channels and the SID
+// exactly as if the song had played up to there. A worker replays the song
+// and the mixer swaps the result in, meanwhile playback goes on.
+void seek(int song_pos) {
+    if (g_seek_job) g_seek_job->canceled = true;
+    if (song_pos == 0) {
+        g_player.m_start_song_pos = {};
+        g_player.m_start_patt_pos = {};
+        g_player.set_action(gt::Player::Action::Start);
+        return;
+    }
+
+    song_version::Version song = song_version::publish();
+    Sid::Model            model           = Sid::Model(song->model);
+    Sid::SamplingMethod   sampling_method = Sid::SamplingMethod(settings_view::settings().sampling_method);
+    Sid::Engine           engine          = Sid::Engine(settings_view::settings().sid_engine);
+    int                   write_order     = settings_view::settings().register_write_order;
+    auto                  replay          = std::make_shared<Mixer::Seek>(*song);
+    auto                  reached         = std::make_shared<bool>(false);
+
+    // the replay's player reads the pinned version, so the work holds on to it
+    g_seek_job = jobs::start(jobs::Priority::High, [replay, reached, song, song_pos, model, sampling_method, engine, write_order](jobs::Token& token) {
+        replay->sid.init(model, sampling_method, engine);
+        replay->mixer.set_register_write_order(write_order);
+        *reached = replay->mixer.fast_forward(song_pos, token.canceled);
+    }, [replay, reached, song_pos, model, sampling_method, engine, write_order](jobs::Token& token) {
+        // stopped or sought again meanwhile
+        if (token.canceled || !g_player.is_playing()) return;
+        if (!*reached) {
+            // not reachable from the start, fall back to a cold start
+            LOGW("app::seek: song position %d not reached", song_pos);
+            g_player.m_start_song_pos.fill(song_pos);
+            g_player.m_start_patt_pos = {};
+            g_player.set_action(gt::Player::Action::Start);
+            return;
+        }
+        // the SID must match the one the audio thread is set up for
+        if (Sid::Model(g_song.model) != model ||
+            Sid::SamplingMethod(settings_view::settings().sampling_method) != sampling_method ||
+            Sid::Engine(settings_view::settings().sid_engine) != engine ||
+            settings_view::settings().register_write_order != write_order)
+        {
+            seek(song_pos);
+            return;
+        }
+        g_mixer.seek(replay);
+    });
+}
+
+
 void draw_play_buttons() {
 
     gui::cursor({ 0, canvas_height() - TAB_HEIGHT - gui::FRAME_WIDTH });
@@ -102,8 +190,8 @@ void draw_play_buttons() {
     backward_time += gui::frame_time();
     if (gui::button(gui::Icon::FastBackward)) {
         if (g_player.is_playing()) {
-            g_player.set_action(backward_time > 0.5f ? gt::Player::Action::RestartPattern
-                                                     : gt::Player::Action::FastBackward);
+            int pos = g_player.m_current_song_pos[0];
+            seek(backward_time > 0.5f ? pos : std::max(0, pos - 1));
         }
         else {
             g_player.m_start_patt_pos = {};
@@ -152,7 +240,8 @@ void draw_play_buttons() {
     gui::same_line();
     if (gui::button(gui::Icon::FastForward)) {
         if (g_player.is_playing()) {
-            g_player.set_action(gt::Player::Action::FastForward);
+            int pos = g_player.m_current_song_pos[0] + 1;
+            seek(pos < g_song.song_len ? pos : g_song.song_loop);
         }
         else {
             g_player.m_start_patt_pos   = {};
@@ -187,6 +276,127 @@ void draw_splash() {
 }
 
 
+void draw_view() {
+    constexpr char const* VIEW_NAMES[] = {
+        "splash",
+        "project_view::draw",
+        "song_view::draw",
+        "song_view::draw_pattern",
+        "instrument_view::draw",
+        "instrument_manager_view::draw",
+        "settings_view::draw",
+    };
+    PROFILE_SCOPE(VIEW_NAMES[int(g_view)]);
+    switch (g_view) {
+    case View::Splash: draw_splash(); break;
+    case View::Project: project_view::draw(); break;
+    case View::Song: song_view::draw(); break;
+    case View::Pattern: song_view::draw_pattern(); break;
+    case View::Instrument: instrument_view::draw(); break;
+    case View::InstrumentManager: instrument_manager_view::draw(); break;
+    case View::Settings: settings_view::draw(); break;
+    }
+}
+
+
+void draw_gui() {
+    // import song
+    if (!g_import_song_path.empty()) {
+        g_view = View::Project;
+        project_view::init();
+        project_view::import_song(g_import_song_path);
+        g_import_song_path = "";
+    }
+
+    song_index::sync();
+    table_space::sync();
+
+    if (gui::max_window_index() == 0 && !gui::has_active_item() && !gui::input_text_active()) {
+        song_undo::sync();
+        song_journal::sync();
+    }
+
+    gfx::canvas(g_canvas);
+    gfx::blend(true);
+    gfx::clear(0.0, 0.0, 0.0);
+
+    gui::begin_frame();
+
+    gui::item_size({ (CANVAS_WIDTH - TAB_HEIGHT - BUTTON_HEIGHT * 2) / 3 , TAB_HEIGHT });
+    gui::align(gui::Align::Center);
+    gui::button_style(gui::ButtonStyle::Tab);
+    if (gui::button("PROJECT", g_view == View::Project)) {
+        g_view = View::Project;
+        project_view::init();
+    }
+    gui::same_line();
+    if (gui::button("SONG", g_view == View::Song || g_view == View::Pattern)) {
+        // if (g_view == View::Song) {
+        //     g_view = View::Pattern;
+        // }
+        // else {
+            g_view = View::Song;
+        // }
+    }
+    gui::same_line();
+
+    gui::ColorTheme old_theme = gui::color_theme();
+    if (g_view == View::Instrument) {
+        gui::color_theme().button_normal = color::BUTTON_ACTIVE;
+        gui::color_theme().button_pressed = color::BUTTON_ALT_PRESSED;
+    }
+    else if (g_view == View::InstrumentManager) {
+        gui::color_theme().button_normal = color::BUTTON_ALT_ACTIVE;
+    }
+    if (gui::button("INSTR")) {
+        if (g_view == View::Instrument) {
+            g_view = View::InstrumentManager;
+            instrument_manager_view::init();
+        }
+        else {
+            g_view = View::Instrument;
+        }
+    }
+    gui::color_theme() = old_theme;
+
+
+    gui::same_line();
+    gui::item_size({ CANVAS_WIDTH - gui::cursor().x - BUTTON_HEIGHT * 2, TAB_HEIGHT });
+    if (gui::button(gui::Icon::Settings, g_view == View::Settings)) {
+        g_view = View::Settings;
+    }
+
+
+    // undo/redo buttons
+    gui::button_style(gui::ButtonStyle::Normal);
+    gui::item_size({ BUTTON_HEIGHT, BUTTON_HEIGHT });
+    gui::cursor({ CANVAS_WIDTH - BUTTON_HEIGHT * 2, TAB_HEIGHT - BUTTON_HEIGHT });
+    gui::disabled(!song_undo::can_undo());
+    if (gui::button(gui::Icon::Undo)) {
+        song_undo::undo();
+    }
+    gui::same_line();
+    gui::disabled(!song_undo::can_redo());
+    if (gui::button(gui::Icon::Redo)) {
+        song_undo::redo();
+    }
+    gui::disabled(false);
+
+    gui::cursor({ 0, TAB_HEIGHT });
+    gui::item_size({ CANVAS_WIDTH, BUTTON_HEIGHT });
+    gui::separator();
+
+    draw_view();
+    draw_play_buttons();
+    profiler::draw();
+    gui::end_frame();
+
+    // find this frame's edits, which the syncs above catch up with next frame,
+    // and let the audio thread hear them
+    song_version::publish();
+}
+
+
 } // namespace
 
 
@@ -196,9 +406,11 @@ Sid&               sid() { return g_sid; }
 int                canvas_height() { return g_canvas_height; }
 std::string const& storage_dir() { return g_storage_dir; }
 void               set_storage_dir(std::string const& storage_dir) { g_storage_dir = storage_dir; }
-void               set_import_song_path(std::string const& import_song_path) { g_import_song_path = import_song_path; }
+void               set_import_song_path(std::string const& import_song_path) { g_import_song_path = import_song_path; request_redraw(); }
+void               request_redraw() { g_redraw_requested = true; }
 bool               is_in_song_view() { return g_view == View::Song; }
 void               go_to_instrument_view() { g_view = View::Instrument; }
+void               go_to_song_view()       { g_view = View::Song; }
 
 void draw_confirm() {
     if (g_confirm_header.empty()) return;
@@ -253,112 +465,42 @@ void alert(std::string header, std::string detail) {
 }
 
 
-void Mixer::mix(int16_t* buffer, int length) {
-    enum {
-        REG_COUNT        = 25,
-        REG_WRITE_CYCLES = 14,
-    };
-
-    // NOTE: this is an extract from the GoatTracker changelog
-    // 15 January 2009
-    // v2.68
-    //           - SID register write order tweaked to resemble JCH NewPlayer 21.
-    //           - Unbuffered playroutine optimized & modified to resemble buffered
-    //             mode timing more.
-    // ...
-    // 23 July 2014
-    // v2.73     - Reverted to old playroutine timing.
-    //           - Added full buffering option (similar to ZP ghostregs) which will
-    //             buffer everything to ghost regs and dump the previous frame to the
-    //             SID at the beginning of the play call
-    constexpr uint8_t REG_ORDERS[2][2][REG_COUNT] = {
-        // v2.68
-        {
-            {
-                0x15, 0x16, 0x18, 0x17,                   //
-                0x05, 0x06, 0x02, 0x03, 0x00, 0x01, 0x04, //
-                0x0c, 0x0d, 0x09, 0x0a, 0x07, 0x08, 0x0b, //
-                0x13, 0x14, 0x10, 0x11, 0x0e, 0x0f, 0x12, //
-            },
-            {
-                0x15, 0x16, 0x18, 0x17,                   //
-                0x04, 0x00, 0x01, 0x02, 0x03, 0x05, 0x06, //
-                0x0b, 0x07, 0x08, 0x09, 0x0a, 0x0c, 0x0d, //
-                0x12, 0x0e, 0x0f, 0x10, 0x11, 0x13, 0x14, //
-            },
-        },
-        // v2.73
-        {
-            {
-                0x18, 0x17, 0x16, 0x15,                   //
-                0x14, 0x13, 0x12, 0x11, 0x10, 0x0f, 0x0e, //
-                0x0d, 0x0c, 0x0b, 0x0a, 0x09, 0x08, 0x07, //
-                0x06, 0x05, 0x04, 0x03, 0x02, 0x01, 0x00, //
-            },
-            {
-                0x00, 0x01, 0x02, 0x03,                   //
-                0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, //
-                0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x11, //
-                0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, //
-            },
-        },
-    };
-    uint8_t const* reg_order =
-        REG_ORDERS[settings_view::settings().register_write_order][m_player.song().adparam >= 0xf000];
-
-    int const  ticks_per_second  = m_player.song().multiplier * 50 ?: 25;
-    int const  cycles_per_tick   = Sid::CLOCKRATE_PAL / ticks_per_second;
-    int        cycles_left       = length * uint64_t(Sid::CLOCKRATE_PAL) / MIXRATE;
-    while (cycles_left > 0) {
-        if (m_cycles_to_next_write == 0) {
-            if (m_reg == 0) m_player.play_routine();
-            // write register
-            int r = reg_order[m_reg];
-            m_sid.set_reg(r, m_player.registers()[r]);
-            // next register
-            if (++m_reg >= REG_COUNT) {
-                m_reg = 0;
-                m_cycles_to_next_write = cycles_per_tick - REG_WRITE_CYCLES * (REG_COUNT - 1);
-            }
-            else {
-                m_cycles_to_next_write = REG_WRITE_CYCLES;
-            }
-        }
-        int c = std::min(cycles_left, m_cycles_to_next_write);
-        cycles_left -= c;
-        m_cycles_to_next_write -= c;
-        int n = m_sid.clock(c, buffer, length);
-        buffer += n;
-        length -= n;
-    }
-    // sometimes there's a sample left that needs rendering
-    assert(length <= 1);
-    if (length > 0) {
-        m_sid.clock(9999, buffer, length);
-    }
-}
-
-
 void audio_callback(int16_t* buffer, int length) {
-    if (!g_initialized) {
+    int64_t start = profiler::now_ns();
+    // Pin the latest version until the next call, as the player keeps pointing to it.
+    // The editor holds on to replaced versions, so they are never freed here.
+    static song_version::Version song;
+    song = song_version::pin();
+    if (!g_initialized || !song) {
         memset(buffer, 0, sizeof(int16_t) * length);
         return;
     }
+    g_player.set_song(*song);
 
     // update sid settings
-    static int chip_model      = int(g_song.model);
+    static int chip_model      = int(song->model);
     static int sampling_method = settings_view::settings().sampling_method;
+    static int sid_engine      = -1; // settings may load after init
 
-    if (chip_model != int(g_song.model)) {
-        chip_model = int(g_song.model);
+    if (chip_model != int(song->model)) {
+        chip_model = int(song->model);
         g_sid.set_chip_model(Sid::Model(chip_model));
     }
     if (sampling_method != settings_view::settings().sampling_method) {
         sampling_method = settings_view::settings().sampling_method;
         g_sid.set_sampling_method(Sid::SamplingMethod(sampling_method));
     }
+    if (sid_engine != settings_view::settings().sid_engine) {
+        sid_engine = settings_view::settings().sid_engine;
+        g_sid.set_engine(Sid::Engine(sid_engine));
+    }
 
-    g_mixer.mix(buffer, length);
+    g_mixer.set_register_write_order(settings_view::settings().register_write_order);
+    {
+        PROFILE_SCOPE("Mixer::mix");
+        g_mixer.mix(buffer, length);
+    }
+    profiler::audio_callback(start, profiler::now_ns(), length);
 }
 
 void reset() {
@@ -371,8 +513,11 @@ void reset() {
     instrument_manager_view::reset();
     command_edit::reset();
     song_undo::reset();
+    song_index::reset();
+    table_space::reset();
     g_song.clear();
-    g_sid.init(Sid::Model::MOS8580, Sid::SamplingMethod::Fast);
+    song_version::publish();
+    g_sid.init(Sid::Model::MOS8580, Sid::SamplingMethod::Fast, Sid::Engine(settings_view::settings().sid_engine));
     g_player.set_action(gt::Player::Action::Reset);
 }
 
@@ -385,16 +530,21 @@ void init() {
     g_song.instruments[1].ptr[0] = 1;
     g_song.ltable[0][0] = 0x21;
     g_song.ltable[0][1] = 0xff;
+    jobs::init();
+    song_journal::init();
 
     gfx::init();
     gui::init();
     project_view::init();
 
     g_initialized = true;
+    request_redraw();
 }
 
 void free() {
     LOGD("app::free");
+    jobs::free();
+    song_journal::free();
     gfx::free();
     gui::free();
     g_canvas.free();
@@ -419,116 +569,57 @@ void resize(int width, int height) {
 void touch(int x, int y, bool pressed) {
     gui::touch_event((x - g_canvas_offset) / g_canvas_scale,
                      (y - g_inset_top) / g_canvas_scale, pressed);
+    request_redraw();
 }
 
 void key(int key, int unicode) {
     gui::key_event(key, unicode);
+    request_redraw();
     if (key == gui::KEYCODE_PRINTSCREEN) {
         g_take_screenshot = true;
     }
 }
 
-void draw() {
+bool draw() {
+    profiler::enable(settings_view::settings().profiler_overlay);
+    profiler::update();
+    PROFILE_SCOPE("app::draw");
+
+    jobs::drain();
+
     // setup canvas
     if (g_canvas_setup_requested) {
         g_canvas_setup_requested = false;
         setup_canvas();
+        request_redraw();
     }
 
-    // import song
-    if (!g_import_song_path.empty()) {
-        g_view = View::Project;
-        project_view::init();
-        project_view::import_song(g_import_song_path);
-        g_import_song_path = "";
-    }
-
-    if (gui::max_window_index() == 0 && !gui::has_active_item() && !gui::input_text_active()) {
-        song_undo::sync();
-    }
-
-    gfx::canvas(g_canvas);
-    gfx::blend(true);
-    gfx::clear(0.0, 0.0, 0.0);
-
-    gui::begin_frame();
-
-    gui::item_size({ (CANVAS_WIDTH - TAB_HEIGHT - BUTTON_HEIGHT * 2) / 3 , TAB_HEIGHT });
-    gui::align(gui::Align::Center);
-    gui::button_style(gui::ButtonStyle::Tab);
-    if (gui::button("PROJECT", g_view == View::Project)) {
-        g_view = View::Project;
-        project_view::init();
-    }
-    gui::same_line();
-    if (gui::button("SONG", g_view == View::Song || g_view == View::Pattern)) {
-        // if (g_view == View::Song) {
-        //     g_view = View::Pattern;
-        // }
-        // else {
-            g_view = View::Song;
-        // }
-    }
-    gui::same_line();
-
-    gui::ColorTheme old_theme = gui::color_theme();
-    if (g_view == View::Instrument) {
-        gui::color_theme().button_normal = color::BUTTON_ACTIVE;
-        gui::color_theme().button_pressed = color::BUTTON_ALT_PRESSED;
-    }
-    else if (g_view == View::InstrumentManager) {
-        gui::color_theme().button_normal = color::BUTTON_ALT_ACTIVE;
-    }
-    if (gui::button("INSTR")) {
-        if (g_view == View::Instrument) {
-            g_view = View::InstrumentManager;
-            instrument_manager_view::init();
-        }
-        else {
-            g_view = View::Instrument;
-        }
-    }
-    gui::color_theme() = old_theme;
-
-
-    gui::same_line();
-    gui::item_size({ CANVAS_WIDTH - gui::cursor().x - BUTTON_HEIGHT * 2, TAB_HEIGHT });
-    if (gui::button(gui::Icon::Settings, g_view == View::Settings)) {
-        g_view = View::Settings;
+    // Only rebuild the gui when something may have changed: input, sounding
+    // notes, or a view that asked for another frame. Playback is followed at
+    // a reduced rate, and whenever the play row changes.
+    if (g_redraw_requested.exchange(false) || gui::touch::pressed() || gui::input_text_active()) {
+        g_settle_frames = SETTLE_FRAMES;
     }
-
-
-    // undo/redo buttons
-    gui::button_style(gui::ButtonStyle::Normal);
-    gui::item_size({ BUTTON_HEIGHT, BUTTON_HEIGHT });
-    gui::cursor({ CANVAS_WIDTH - BUTTON_HEIGHT * 2, TAB_HEIGHT - BUTTON_HEIGHT });
-    gui::disabled(!song_undo::can_undo());
-    if (gui::button(gui::Icon::Undo)) {
-        song_undo::undo();
+    bool redraw = g_settle_frames > 0;
+    if (g_player.is_playing()) {
+        redraw |= g_player.m_current_song_pos != g_drawn_song_pos;
+        redraw |= g_player.m_current_patt_pos != g_drawn_patt_pos;
+        redraw |= ms_since_last_draw() >= 1000 / PLAYBACK_FPS;
     }
-    gui::same_line();
-    gui::disabled(!song_undo::can_redo());
-    if (gui::button(gui::Icon::Redo)) {
-        song_undo::redo();
+    if (redraw) {
+        if (g_settle_frames > 0) --g_settle_frames;
+        g_last_draw_time = Clock::now();
+        g_drawn_song_pos = g_player.m_current_song_pos;
+        g_drawn_patt_pos = g_player.m_current_patt_pos;
+        draw_gui();
     }
-    gui::disabled(false);
-
-    gui::cursor({ 0, TAB_HEIGHT });
-    gui::item_size({ CANVAS_WIDTH, BUTTON_HEIGHT });
-    gui::separator();
-
-    switch (g_view) {
-    case View::Splash: draw_splash(); break;
-    case View::Project: project_view::draw(); break;
-    case View::Song: song_view::draw(); break;
-    case View::Pattern: song_view::draw_pattern(); break;
-    case View::Instrument: instrument_view::draw(); break;
-    case View::InstrumentManager: instrument_manager_view::draw(); break;
-    case View::Settings: settings_view::draw(); break;
+    else {
+#ifndef ANDROID
+        // the last presented frame is still valid
+        return false;
+#endif
+        // GLSurfaceView swaps every frame, so the cached canvas must be blitted
     }
-    draw_play_buttons();
-    gui::end_frame();
-
 
     // draw canvas
     gfx::reset_canvas();
@@ -545,7 +636,6 @@ void draw() {
         { p + s, S.xo(), white },
         { p + s.oy(), {}, white },
     };
-    mesh.indices = { 0, 1, 2, 0, 2, 3 };
     gfx::draw(mesh, g_canvas);
 
 #ifndef ANDROID
@@ -569,6 +659,22 @@ void draw() {
         file.close();
     }
 #endif
+
+    return true;
+}
+
+
+int frame_timeout() {
+    if (g_redraw_requested || needs_full_rate()) return 0;
+    int timeout = IDLE_TIMEOUT_MS;
+    if (g_player.is_playing()) {
+        // wake up every tick to catch row changes
+        int tick_ms = 1000 / ticks_per_second(g_song);
+        int next_ms = 1000 / PLAYBACK_FPS - ms_since_last_draw();
+        timeout = std::max(1, std::min(tick_ms, next_ms));
+    }
+    if (jobs::busy()) timeout = std::min<int>(timeout, JOB_POLL_MS);
+    return timeout;
 }
 
 
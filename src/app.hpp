@@ -5,6 +5,7 @@
 #include <functional>
 #include "gtplayer.hpp"
 #include "gtsong.hpp"
+#include "mixer.hpp"
 #include "sid.hpp"
 
 
@@ -21,19 +22,6 @@ namespace app {
     };
 
 
-    class Mixer {
-    public:
-        Mixer(gt::Player& player, Sid& sid) : m_player(player), m_sid(sid) {}
-        void mix(int16_t* buffer, int length);
-
-    private:
-        gt::Player& m_player;
-        Sid&        m_sid;
-        int         m_cycles_to_next_write = 0;
-        int         m_reg                  = 0;
-    };
-
-
     gt::Song&          song();
     gt::Player&        player();
     Sid&               sid();
@@ -43,7 +31,12 @@ namespace app {
 
     bool               is_in_song_view();
     void               go_to_instrument_view();
+    void               go_to_song_view();
     void               set_import_song_path(std::string const& import_song_path);
+    void               request_redraw();
+    // how long the platform may wait for input before calling draw() again,
+    // 0 to draw at the display rate
+    int                frame_timeout();
 
     using ConfirmCallback = std::function<void(bool)>;
     void draw_confirm();
@@ -57,7 +50,7 @@ namespace app {
     void set_insets(int top_inset, int bottom_inset);
     void touch(int x, int y, bool pressed);
     void key(int key, int unicode);
-    void draw();
+    bool draw(); // returns false if the previous frame is still valid
     void audio_callback(int16_t* buffer, int length);
 
 }
@@ -15,8 +15,10 @@
 #include "gfx.hpp"
 #include "log.hpp"
 #include "platform.hpp"
+#include "profiler.hpp"
 #include "stb_image.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstddef>
 
@@ -77,10 +79,10 @@ void Canvas::free() {
 
 bool Image::init(char const* name) {
     free();
-    std::vector<uint8_t> buf;
-    if (!platform::load_asset(name, buf)) return false;
+    platform::Asset asset;
+    if (!platform::load_asset(name, asset)) return false;
     int w = 0, h = 0, c = 0;
-    uint8_t* p = stbi_load_from_memory(buf.data(), buf.size(), &w, &h, &c, 0);
+    uint8_t* p = stbi_load_from_memory(asset.data, asset.size, &w, &h, &c, 0);
     assert(c == 4);
     Texture::init({w, h}, p);
     stbi_image_free(p);
@@ -90,6 +92,7 @@ bool Image::init(char const* name) {
 namespace {
 
     ivec2  g_screen_size;
+    Canvas const* g_current_canvas;
 
     GLuint g_program;
     GLint  g_pos_scale_loc;
@@ -97,26 +100,135 @@ namespace {
     GLint  g_tex_loc;
 
     GLuint g_vao;
-    GLuint g_vbo;
-    GLuint g_ebo;
+
+
+    // Streaming buffer that is written front to back with glBufferSubData.
+    // Storage is only orphaned when the buffer is full, rather than
+    // reallocated on every draw call. GLES2 has neither fences nor
+    // glMapBufferRange, so orphaning is what keeps the driver from stalling.
+    class StreamBuffer {
+    public:
+        void init(GLenum target) {
+            m_target = target;
+            glGenBuffers(1, &m_buffer);
+            glBindBuffer(m_target, m_buffer);
+        }
+        void free() {
+            glDeleteBuffers(1, &m_buffer);
+            m_buffer   = 0;
+            m_capacity = 0;
+            m_offset   = 0;
+        }
+        // returns the byte offset of the data within the buffer
+        size_t push(void const* data, size_t size) {
+            glBindBuffer(m_target, m_buffer);
+            if (m_offset + size > m_capacity) {
+                while (m_capacity < size) m_capacity = std::max<size_t>(m_capacity * 2, MIN_CAPACITY);
+                glBufferData(m_target, m_capacity, nullptr, GL_STREAM_DRAW);
+                m_offset = 0;
+            }
+            size_t offset = m_offset;
+            glBufferSubData(m_target, offset, size, data);
+            m_offset += (size + 3) & ~size_t(3);
+            return offset;
+        }
+    private:
+        enum { MIN_CAPACITY = 1 << 16 };
+        GLenum m_target;
+        GLuint m_buffer   = 0;
+        size_t m_capacity = 0;
+        size_t m_offset   = 0;
+    };
+
+    enum {
+        // 16 bit indices address at most this many vertices per draw call.
+        // boxes take 54 indices each, so fewer keep the index buffer small
+        MAX_QUAD_VERTICES = 0x10000,
+        MAX_BOX_VERTICES  = 0x4000,
+        QUAD_INDICES      = MAX_QUAD_VERTICES / 4 * 6,
+        BOX_INDICES       = MAX_BOX_VERTICES / 16 * 54,
+    };
+
+    StreamBuffer g_vbo;
+    GLuint       g_ebo; // the quad index pattern, followed by the box pattern
+
+    // meshes of one batch are merged here before uploading
+    std::vector<Vertex>       g_batch_vertices;
+    std::vector<Mesh::BoxRun> g_batch_box_runs;
+
+
+    // GLES2 has no base vertex, so the attributes are pointed at the vertex data
+    void point_attributes(size_t offset) {
+        glVertexAttribPointer(0, 2, GL_SHORT, GL_FALSE, sizeof(Vertex), (void*) (offset + offsetof(Vertex, pos)));
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_FALSE, sizeof(Vertex), (void*) (offset + offsetof(Vertex, uv)));
+        glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (void*) (offset + offsetof(Vertex, col)));
+    }
+
+    // Uploads the vertices once, then draws the quads and box runs in order.
+    // A box run needs the attributes pointed at its first vertex, where its
+    // index pattern starts. Quads are drawn from the matching place in the
+    // quad pattern, so they only move the attributes when 16 bit indices
+    // can't reach them. Draw calls are split at primitive boundaries, so
+    // the splits are invisible.
+    void draw_mesh(Vertex const* vertices, size_t vertex_count, Mesh::BoxRun const* runs, size_t run_count) {
+        if (vertex_count == 0) return;
+        glBindVertexArray(g_vao);
+        size_t offset = g_vbo.push(vertices, sizeof(Vertex) * vertex_count);
+        size_t base   = 0; // the vertex the attributes point at
+        point_attributes(offset);
+
+        auto quads = [&](size_t first, size_t end) {
+            while (first < end) {
+                if (first - base >= MAX_QUAD_VERTICES) {
+                    base = first;
+                    point_attributes(offset + base * sizeof(Vertex));
+                }
+                size_t n = std::min<size_t>(end, base + MAX_QUAD_VERTICES) - first;
+                glDrawElements(GL_TRIANGLES, n / 4 * 6, GL_UNSIGNED_SHORT,
+                               (void*) ((first - base) / 4 * 6 * sizeof(uint16_t)));
+                first += n;
+            }
+        };
+        auto boxes = [&](size_t first, size_t end) {
+            while (first < end) {
+                base = first;
+                point_attributes(offset + base * sizeof(Vertex));
+                size_t n = std::min<size_t>(end - first, MAX_BOX_VERTICES);
+                glDrawElements(GL_TRIANGLES, n / 16 * 54, GL_UNSIGNED_SHORT,
+                               (void*) (QUAD_INDICES * sizeof(uint16_t)));
+                first += n;
+            }
+        };
+
+        size_t pos = 0;
+        for (size_t i = 0; i < run_count; ++i) {
+            quads(pos, runs[i].first);
+            boxes(runs[i].first, runs[i].first + runs[i].count);
+            pos = runs[i].first + runs[i].count;
+        }
+        quads(pos, vertex_count);
+    }
 
 
 } // namspace
 
 
 void reset_canvas() {
+    g_current_canvas = nullptr;
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
     glUseProgram(g_program);
     glUniform2f(g_pos_scale_loc, 2.0f / g_screen_size.x, 2.0f / g_screen_size.y);
     glViewport(0, 0, g_screen_size.x, g_screen_size.y);
 }
 void canvas(Canvas const& canvas) {
+    g_current_canvas = &canvas;
     glBindFramebuffer(GL_FRAMEBUFFER, canvas.m_gl_framebuffer);
     glUseProgram(g_program);
     glUniform2f(g_pos_scale_loc, 2.0f / canvas.size().x, 2.0f / canvas.size().y);
     glViewport(0, 0, canvas.size().x, canvas.size().y);
 }
 
+Canvas const* current_canvas() { return g_current_canvas; }
 
 
 bool init() {
@@ -193,16 +305,32 @@ bool init() {
 
     glGenVertexArrays(1, &g_vao);
     glBindVertexArray(g_vao);
-    glGenBuffers(1, &g_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, g_vbo);
+    g_vbo.init(GL_ARRAY_BUFFER);
+
+    // all meshes share one static index buffer, with the pattern for quad
+    // lists followed by the one for lists of 4x4 vertex grids
+    std::vector<uint16_t> indices;
+    indices.reserve(QUAD_INDICES + BOX_INDICES);
+    for (int i = 0; i < MAX_QUAD_VERTICES; i += 4) {
+        indices.insert(indices.end(), { uint16_t(i), uint16_t(i + 1), uint16_t(i + 2),
+                                        uint16_t(i), uint16_t(i + 2), uint16_t(i + 3) });
+    }
+    for (int b = 0; b < MAX_BOX_VERTICES; b += 16) {
+        for (int y = 0; y < 3; ++y) {
+            for (int x = 0; x < 3; ++x) {
+                int i = b + y * 4 + x;
+                indices.insert(indices.end(), { uint16_t(i), uint16_t(i + 1), uint16_t(i + 5),
+                                                uint16_t(i), uint16_t(i + 5), uint16_t(i + 4) });
+            }
+        }
+    }
     glGenBuffers(1, &g_ebo);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint16_t) * indices.size(), indices.data(), GL_STATIC_DRAW);
 
-    glVertexAttribPointer(0, 2, GL_SHORT, GL_FALSE, sizeof(Vertex), (void*) 0);
+    // attribute pointers are set per draw call
     glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 2, GL_SHORT, GL_FALSE, sizeof(Vertex), (void*) 4);
     glEnableVertexAttribArray(1);
-    glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (void*) 8);
     glEnableVertexAttribArray(2);
 
     return true;
@@ -210,7 +338,7 @@ bool init() {
 
 void free() {
     glDeleteVertexArrays(1, &g_vao);
-    glDeleteBuffers(1, &g_vbo);
+    g_vbo.free();
     glDeleteBuffers(1, &g_ebo);
     glDeleteProgram(g_program);
 }
@@ -236,25 +364,37 @@ void blend(bool enabled) {
 }
 
 void draw(Mesh const& mesh, Texture const& tex) {
+    Mesh const* meshes[] = { &mesh };
+    draw(meshes, 1, tex);
+}
 
-    glBindBuffer(GL_ARRAY_BUFFER, g_vbo);
-    glBufferData(GL_ARRAY_BUFFER,
-                 sizeof(Vertex) * mesh.vertices.size(),
-                 mesh.vertices.data(),
-                 GL_STREAM_DRAW);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                 sizeof(uint16_t) * mesh.indices.size(),
-                 mesh.indices.data(),
-                 GL_STREAM_DRAW);
-
+void draw(Mesh const* const meshes[], int count, Texture const& tex) {
+    PROFILE_SCOPE("gfx::draw");
     glUniform2f(g_uv_scale_loc, 1.0f / tex.m_size.x, 1.0f / tex.m_size.y);
     glBindTexture(GL_TEXTURE_2D, tex.m_gl_texture);
     glUniform1i(g_tex_loc, 0);
 
-    glBindVertexArray(g_vao);
-    glDrawElements(GL_TRIANGLES, mesh.indices.size(), GL_UNSIGNED_SHORT, 0);
+    if (count == 1) {
+        Mesh const& m = *meshes[0];
+        draw_mesh(m.vertices.data(), m.vertices.size(), m.box_runs.data(), m.box_runs.size());
+        return;
+    }
+
+    // merge meshes into a single upload
+    g_batch_vertices.clear();
+    g_batch_box_runs.clear();
+    for (int i = 0; i < count; ++i) {
+        Mesh const& m = *meshes[i];
+        uint32_t base = g_batch_vertices.size();
+        g_batch_vertices.insert(g_batch_vertices.end(), m.vertices.begin(), m.vertices.end());
+        for (Mesh::BoxRun r : m.box_runs) {
+            r.first += base;
+            Mesh::BoxRun* last = g_batch_box_runs.empty() ? nullptr : &g_batch_box_runs.back();
+            if (last && last->first + last->count == r.first) last->count += r.count;
+            else g_batch_box_runs.push_back(r);
+        }
+    }
+    draw_mesh(g_batch_vertices.data(), g_batch_vertices.size(), g_batch_box_runs.data(), g_batch_box_runs.size());
 }
 
 
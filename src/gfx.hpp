@@ -13,14 +13,27 @@ struct Vertex {
 };
 
 
+// A list of quads, four vertices each, in the order pos, pos + size.x,
+// pos + size, pos + size.y. Runs of 9-slice boxes are mixed in, sixteen
+// vertices each, a 4x4 grid in rows from pos. Both index patterns are
+// shared by all meshes.
 struct Mesh {
-    std::vector<Vertex>   vertices;
-    std::vector<uint16_t> indices;
+    struct BoxRun {
+        uint32_t first; // vertex
+        uint32_t count; // vertices, a multiple of 16
+    };
+    std::vector<Vertex> vertices;
+    std::vector<BoxRun> box_runs;
+
+    void clear() {
+        vertices.clear();
+        box_runs.clear();
+    }
 };
 
 
 class Texture {
-friend void draw(Mesh const& mesh, Texture const& tex);
+friend void draw(Mesh const* const meshes[], int count, Texture const& tex);
 public:
     enum FilterMode { NEAREST, LINEAR };
     ivec2 size() const { return m_size; }
@@ -58,12 +71,18 @@ void free();
 
 void  screen_size(ivec2 size);
 ivec2 screen_size();
+#ifdef GFX_SOFTWARE
+uint8_t const* screen_pixels(); // RGBA, bottom row first
+#endif
 
 void blend(bool enabled);
 void reset_canvas();
 void canvas(Canvas const& canvas);
+Canvas const* current_canvas(); // nullptr for the screen
 
 void clear(float r, float g, float b);
 void draw(Mesh const& mesh, Texture const& tex);
+// draw several meshes in order with a single upload
+void draw(Mesh const* const meshes[], int count, Texture const& tex);
 
 } // namespace gfx
@@ -0,0 +1,336 @@
+// Software implementation of the gfx interface.
+// It rasterizes into memory buffers and needs no GPU, which makes frame
+// cost measurable on headless machines and the output pixel exact.
+// Build with GFX_SOFTWARE to use it instead of gfx.cpp.
+
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_NO_FAILURE_STRINGS
+#define STBI_ONLY_PNG
+#include "gfx.hpp"
+#include "platform.hpp"
+#include "profiler.hpp"
+#include "stb_image.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <memory>
+
+
+namespace gfx {
+namespace {
+
+    struct Surface {
+        ivec2                size;
+        std::vector<u8vec4>  pixels; // row y at y * size.x, as uploaded
+        bool                 linear;
+        bool                 used;
+    };
+
+    // Handles are indices plus one, so that zero means no texture. Surfaces
+    // don't move when more are allocated, so g_target stays valid.
+    std::vector<std::unique_ptr<Surface>> g_surfaces;
+    Surface                               g_screen;
+    Surface*                              g_target;
+    Canvas const*                         g_current_canvas;
+    ivec2                                 g_screen_size;
+    bool                                  g_blend;
+    bool                                  g_initialized;
+
+
+    uint32_t alloc_surface(ivec2 size) {
+        size_t i = 0;
+        while (i < g_surfaces.size() && g_surfaces[i]->used) ++i;
+        if (i == g_surfaces.size()) g_surfaces.push_back(std::make_unique<Surface>());
+        Surface& s = *g_surfaces[i];
+        s.size   = size;
+        s.linear = false;
+        s.used   = true;
+        s.pixels.assign(size.x * size.y, u8vec4(0));
+        return i + 1;
+    }
+
+    Surface& surface(uint32_t handle) {
+        assert(handle > 0 && handle <= g_surfaces.size());
+        return *g_surfaces[handle - 1];
+    }
+
+
+    u8vec4 sample_nearest(Surface const& s, float u, float v) {
+        int x = clamp<int>(std::floor(u), 0, s.size.x - 1);
+        int y = clamp<int>(std::floor(v), 0, s.size.y - 1);
+        return s.pixels[y * s.size.x + x];
+    }
+
+    u8vec4 sample_linear(Surface const& s, float u, float v) {
+        u -= 0.5f;
+        v -= 0.5f;
+        float fx = std::floor(u);
+        float fy = std::floor(v);
+        float ax = u - fx;
+        float ay = v - fy;
+        int x0 = clamp<int>(fx, 0, s.size.x - 1);
+        int y0 = clamp<int>(fy, 0, s.size.y - 1);
+        int x1 = clamp<int>(fx + 1, 0, s.size.x - 1);
+        int y1 = clamp<int>(fy + 1, 0, s.size.y - 1);
+        u8vec4 a = s.pixels[y0 * s.size.x + x0];
+        u8vec4 b = s.pixels[y0 * s.size.x + x1];
+        u8vec4 c = s.pixels[y1 * s.size.x + x0];
+        u8vec4 d = s.pixels[y1 * s.size.x + x1];
+        auto lerp = [&](uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+            float t = a + (b - a) * ax;
+            float w = c + (d - c) * ax;
+            return uint8_t(t + (w - t) * ay + 0.5f);
+        };
+        return { lerp(a.x, b.x, c.x, d.x), lerp(a.y, b.y, c.y, d.y),
+                 lerp(a.z, b.z, c.z, d.z), lerp(a.w, b.w, c.w, d.w) };
+    }
+
+    // modulate the texel by the vertex color and blend it into the target
+    void shade(u8vec4& dst, u8vec4 col, u8vec4 tex) {
+        int r = (col.x * tex.x + 127) / 255;
+        int g = (col.y * tex.y + 127) / 255;
+        int b = (col.z * tex.z + 127) / 255;
+        int a = (col.w * tex.w + 127) / 255;
+        if (!g_blend) {
+            dst = { uint8_t(r), uint8_t(g), uint8_t(b), uint8_t(a) };
+            return;
+        }
+        // GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA for color and alpha
+        int ia = 255 - a;
+        dst.x = (r * a + dst.x * ia + 127) / 255;
+        dst.y = (g * a + dst.y * ia + 127) / 255;
+        dst.z = (b * a + dst.z * ia + 127) / 255;
+        dst.w = (a * a + dst.w * ia + 127) / 255;
+    }
+
+
+    // Axis aligned quads, i.e. everything the gui emits, are filled row by
+    // row. Pixels are covered if their center lies inside, as in GL.
+    void draw_rect(Vertex const* v, Surface const& tex) {
+        int x0 = std::min(v[0].pos.x, v[2].pos.x);
+        int x1 = std::max(v[0].pos.x, v[2].pos.x);
+        int y0 = std::min(v[0].pos.y, v[2].pos.y);
+        int y1 = std::max(v[0].pos.y, v[2].pos.y);
+        if (x0 == x1 || y0 == y1) return;
+
+        // uv at the edges of the quad
+        float u_left   = v[0].pos.x == x0 ? v[0].uv.x : v[2].uv.x;
+        float u_right  = v[0].pos.x == x0 ? v[2].uv.x : v[0].uv.x;
+        float v_bottom = v[0].pos.y == y0 ? v[0].uv.y : v[2].uv.y;
+        float v_top    = v[0].pos.y == y0 ? v[2].uv.y : v[0].uv.y;
+        float du = (u_right - u_left) / (x1 - x0);
+        float dv = (v_top - v_bottom) / (y1 - y0);
+
+        Surface& dst = *g_target;
+        int cx0 = std::max(x0, 0);
+        int cx1 = std::min(x1, dst.size.x);
+        int cy0 = std::max(y0, 0);
+        int cy1 = std::min(y1, dst.size.y);
+        u8vec4 col = v[0].col;
+        for (int y = cy0; y < cy1; ++y) {
+            float tv = v_bottom + (y + 0.5f - y0) * dv;
+            u8vec4* row = &dst.pixels[y * dst.size.x];
+            for (int x = cx0; x < cx1; ++x) {
+                float tu = u_left + (x + 0.5f - x0) * du;
+                shade(row[x], col, tex.linear ? sample_linear(tex, tu, tv) : sample_nearest(tex, tu, tv));
+            }
+        }
+    }
+
+    // general triangles, interpolating uv and color with barycentric weights
+    void draw_triangle(Vertex const& a, Vertex const& b, Vertex const& c, Surface const& tex) {
+        float area = float(b.pos.x - a.pos.x) * (c.pos.y - a.pos.y) -
+                     float(b.pos.y - a.pos.y) * (c.pos.x - a.pos.x);
+        if (area == 0) return;
+
+        Surface& dst = *g_target;
+        int x0 = std::max<int>(std::min({ a.pos.x, b.pos.x, c.pos.x }), 0);
+        int x1 = std::min<int>(std::max({ a.pos.x, b.pos.x, c.pos.x }), dst.size.x);
+        int y0 = std::max<int>(std::min({ a.pos.y, b.pos.y, c.pos.y }), 0);
+        int y1 = std::min<int>(std::max({ a.pos.y, b.pos.y, c.pos.y }), dst.size.y);
+        auto edge = [](Vertex const& p, Vertex const& q, float x, float y) {
+            return float(q.pos.x - p.pos.x) * (y - p.pos.y) - float(q.pos.y - p.pos.y) * (x - p.pos.x);
+        };
+        for (int y = y0; y < y1; ++y) {
+            for (int x = x0; x < x1; ++x) {
+                float px = x + 0.5f;
+                float py = y + 0.5f;
+                float wa = edge(b, c, px, py) / area;
+                float wb = edge(c, a, px, py) / area;
+                float wc = edge(a, b, px, py) / area;
+                if (wa < 0 || wb < 0 || wc < 0) continue;
+                float tu = a.uv.x * wa + b.uv.x * wb + c.uv.x * wc;
+                float tv = a.uv.y * wa + b.uv.y * wb + c.uv.y * wc;
+                u8vec4 col(uint8_t(a.col.x * wa + b.col.x * wb + c.col.x * wc + 0.5f),
+                           uint8_t(a.col.y * wa + b.col.y * wb + c.col.y * wc + 0.5f),
+                           uint8_t(a.col.z * wa + b.col.z * wb + c.col.z * wc + 0.5f),
+                           uint8_t(a.col.w * wa + b.col.w * wb + c.col.w * wc + 0.5f));
+                shade(dst.pixels[y * dst.size.x + x], col,
+                      tex.linear ? sample_linear(tex, tu, tv) : sample_nearest(tex, tu, tv));
+            }
+        }
+    }
+
+    void draw_quads(Vertex const* v, size_t vertex_count, Surface const& tex) {
+        assert(vertex_count % 4 == 0);
+        for (size_t i = 0; i < vertex_count; i += 4, v += 4) {
+            bool axis_aligned = v[0].pos.y == v[1].pos.y && v[1].pos.x == v[2].pos.x &&
+                                v[2].pos.y == v[3].pos.y && v[3].pos.x == v[0].pos.x &&
+                                v[0].col == v[2].col;
+            if (axis_aligned) {
+                draw_rect(v, tex);
+            }
+            else {
+                draw_triangle(v[0], v[1], v[2], tex);
+                draw_triangle(v[0], v[2], v[3], tex);
+            }
+        }
+    }
+
+    // a box is drawn as the quads of its nine slices, collapsed ones are skipped by draw_rect
+    void draw_boxes(Vertex const* v, size_t vertex_count, Surface const& tex) {
+        assert(vertex_count % 16 == 0);
+        for (size_t i = 0; i < vertex_count; i += 16, v += 16) {
+            for (int y = 0; y < 3; ++y) {
+                for (int x = 0; x < 3; ++x) {
+                    Vertex const* g = v + y * 4 + x;
+                    Vertex const quad[] = { g[0], g[1], g[5], g[4] };
+                    draw_rect(quad, tex);
+                }
+            }
+        }
+    }
+
+    void draw_mesh(Mesh const& m, Surface const& tex) {
+        size_t pos = 0;
+        for (Mesh::BoxRun const& r : m.box_runs) {
+            draw_quads(m.vertices.data() + pos, r.first - pos, tex);
+            draw_boxes(m.vertices.data() + r.first, r.count, tex);
+            pos = r.first + r.count;
+        }
+        draw_quads(m.vertices.data() + pos, m.vertices.size() - pos, tex);
+    }
+
+} // namespace
+
+
+
+void Texture::free() {
+    // textures that outlive gfx::free, like the gui's, have nothing left to free
+    if (m_gl_texture > 0 && g_initialized) {
+        Surface& s = surface(m_gl_texture);
+        s.used = false;
+        s.pixels.clear();
+        s.pixels.shrink_to_fit();
+    }
+    m_gl_texture = 0;
+}
+void Texture::init(ivec2 size, uint8_t const* pixels) {
+    free();
+    m_size = size;
+    m_gl_texture = alloc_surface(size);
+    if (pixels) memcpy(surface(m_gl_texture).pixels.data(), pixels, size.x * size.y * 4);
+}
+void Texture::filter(FilterMode filter) {
+    surface(m_gl_texture).linear = filter == LINEAR;
+}
+#ifndef ANDROID
+void Texture::get_pixel_data(std::vector<uint8_t>& data) {
+    Surface const& s = surface(m_gl_texture);
+    data.resize(m_size.x * m_size.y * 3);
+    for (size_t i = 0; i < s.pixels.size(); ++i) {
+        data[i * 3 + 0] = s.pixels[i].x;
+        data[i * 3 + 1] = s.pixels[i].y;
+        data[i * 3 + 2] = s.pixels[i].z;
+    }
+}
+#endif
+
+
+void Canvas::init(ivec2 size) {
+    free();
+    Texture::init(size, nullptr);
+    m_gl_framebuffer = m_gl_texture;
+}
+void Canvas::free() {
+    Texture::free();
+    m_gl_framebuffer = 0;
+}
+
+
+bool Image::init(char const* name) {
+    free();
+    platform::Asset asset;
+    if (!platform::load_asset(name, asset)) return false;
+    int w = 0, h = 0, c = 0;
+    uint8_t* p = stbi_load_from_memory(asset.data, asset.size, &w, &h, &c, 0);
+    assert(c == 4);
+    Texture::init({w, h}, p);
+    stbi_image_free(p);
+    return true;
+}
+
+
+void reset_canvas() {
+    g_current_canvas = nullptr;
+    if (g_screen.size != g_screen_size) {
+        g_screen.size = g_screen_size;
+        g_screen.pixels.assign(g_screen_size.x * g_screen_size.y, u8vec4(0));
+    }
+    g_target = &g_screen;
+}
+void canvas(Canvas const& canvas) {
+    g_current_canvas = &canvas;
+    g_target = &surface(canvas.m_gl_framebuffer);
+}
+Canvas const* current_canvas() { return g_current_canvas; }
+
+
+bool init() {
+    g_initialized = true;
+    reset_canvas();
+    return true;
+}
+
+void free() {
+    g_initialized = false;
+    g_surfaces.clear();
+    g_screen = {};
+    g_target = nullptr;
+}
+
+
+void screen_size(ivec2 size) { g_screen_size = size; }
+ivec2 screen_size() { return g_screen_size; }
+
+uint8_t const* screen_pixels() {
+    return (uint8_t const*) g_screen.pixels.data();
+}
+
+
+void clear(float r, float g, float b) {
+    u8vec4 c(uint8_t(r * 255 + 0.5f), uint8_t(g * 255 + 0.5f), uint8_t(b * 255 + 0.5f), 255);
+    std::fill(g_target->pixels.begin(), g_target->pixels.end(), c);
+}
+
+void blend(bool enabled) {
+    g_blend = enabled;
+}
+
+void draw(Mesh const& mesh, Texture const& tex) {
+    Mesh const* meshes[] = { &mesh };
+    draw(meshes, 1, tex);
+}
+
+void draw(Mesh const* const meshes[], int count, Texture const& tex) {
+    PROFILE_SCOPE("gfx::draw");
+    Surface const& s = surface(tex.m_gl_texture);
+    for (int i = 0; i < count; ++i) {
+        draw_mesh(*meshes[i], s);
+    }
+}
+
+
+} // namespace gfx
@@ -0,0 +1,203 @@
+// Headless benchmark and golden image check for the software gfx backend.
+// Runs the app without a window or audio device, taps through to a view,
+// draws frames and reports the time per frame. The last frame can be saved
+// as a PPM, or compared pixel by pixel with a golden one, in which case the
+// exit status tells whether they match.
+//
+//   gfxbench [-n frames] [-v project|song|instr] [-o out.ppm] [-g golden.ppm] [song.sng]
+//
+// Run it from the directory that holds assets/, like gtmobile.
+#include "app.hpp"
+#include "gfx.hpp"
+#include "mapped_file.hpp"
+#include "platform.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+
+namespace fs = std::filesystem;
+
+
+// just enough of the platform for the app to run without one
+namespace platform {
+
+bool load_asset(std::string const& name, Asset& asset) {
+    auto file = std::make_shared<MappedFile>();
+    if (!file->open(("assets/" + name).c_str())) return false;
+    asset.data  = file->data();
+    asset.size  = file->size();
+    asset.owner = std::move(file);
+    return true;
+}
+
+std::vector<std::string> list_assets(std::string const& dir) {
+    std::vector<std::string> list;
+    std::error_code ec;
+    for (auto const& entry : fs::directory_iterator("assets/" + dir, ec)) {
+        if (entry.is_regular_file(ec)) list.emplace_back(entry.path().filename().string());
+    }
+    std::sort(list.begin(), list.end());
+    return list;
+}
+
+void show_keyboard(bool enabled) {}
+void export_song(std::string const& path, std::string const& title) {}
+void start_song_import() {}
+void update_setting(int i) {}
+bool poll_midi_event(uint8_t& status, uint8_t& data1, uint8_t& data2) { return false; }
+
+} // namespace platform
+
+
+namespace {
+
+enum {
+    WIDTH  = app::CANVAS_WIDTH,
+    HEIGHT = app::CANVAS_MIN_HEIGHT,
+    // the view tabs, see app::draw_gui
+    TAB_WIDTH = (app::CANVAS_WIDTH - app::TAB_HEIGHT - app::BUTTON_HEIGHT * 2) / 3,
+};
+
+double draw_frame() {
+    auto start = std::chrono::steady_clock::now();
+    app::request_redraw();
+    app::draw();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void tap(int x, int y) {
+    app::touch(x, y, true);
+    draw_frame();
+    app::touch(x, y, false);
+    draw_frame();
+}
+
+// the screen as top-down RGB
+std::vector<uint8_t> screen_rgb() {
+    uint8_t const* pixels = gfx::screen_pixels();
+    std::vector<uint8_t> rgb(WIDTH * HEIGHT * 3);
+    for (int y = 0; y < HEIGHT; ++y) {
+        uint8_t const* src = pixels + (HEIGHT - 1 - y) * WIDTH * 4;
+        for (int x = 0; x < WIDTH; ++x) {
+            memcpy(&rgb[(y * WIDTH + x) * 3], src + x * 4, 3);
+        }
+    }
+    return rgb;
+}
+
+bool write_ppm(char const* path, std::vector<uint8_t> const& rgb) {
+    std::ofstream f(path, std::ios::binary);
+    f << "P6 " << WIDTH << " " << HEIGHT << " 255\n";
+    f.write((char const*) rgb.data(), rgb.size());
+    return f.good();
+}
+
+bool read_ppm(char const* path, std::vector<uint8_t>& rgb) {
+    std::ifstream f(path, std::ios::binary);
+    std::string magic;
+    int w, h, max;
+    if (!(f >> magic >> w >> h >> max) || magic != "P6" || w != WIDTH || h != HEIGHT || max != 255) return false;
+    f.get();
+    rgb.resize(WIDTH * HEIGHT * 3);
+    return bool(f.read((char*) rgb.data(), rgb.size()));
+}
+
+void usage(char const* name) {
+    fprintf(stderr, "usage: %s [-n frames] [-v project|song|instr] [-o out.ppm] [-g golden.ppm] [song.sng]\n", name);
+}
+
+} // namespace
+
+
+int main(int argc, char** argv) {
+    int         frames = 100;
+    int         view   = 0;
+    char const* out_path    = nullptr;
+    char const* golden_path = nullptr;
+    char const* song_path   = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "-n" && has_value) frames = std::max(1, atoi(argv[++i]));
+        else if (arg == "-o" && has_value) out_path = argv[++i];
+        else if (arg == "-g" && has_value) golden_path = argv[++i];
+        else if (arg == "-v" && has_value) {
+            std::string name = argv[++i];
+            if (name == "project") view = 0;
+            else if (name == "song") view = 1;
+            else if (name == "instr") view = 2;
+            else {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg[0] == '-' || song_path) {
+            usage(argv[0]);
+            return 1;
+        }
+        else song_path = argv[i];
+    }
+
+    // a fresh storage dir, so no autosave of an earlier run is restored
+    fs::path storage_dir = fs::temp_directory_path() / "gfxbench";
+    std::error_code ec;
+    fs::remove_all(storage_dir, ec);
+    fs::create_directories(storage_dir);
+    app::set_storage_dir(storage_dir.string());
+
+    app::resize(WIDTH, HEIGHT);
+    app::init();
+    if (song_path) {
+        try {
+            app::song().load(song_path);
+        }
+        catch (gt::LoadError const& e) {
+            fprintf(stderr, "%s: %s\n", song_path, e.msg.c_str());
+            return 1;
+        }
+    }
+
+    // leave the splash screen, then go to the view
+    tap(WIDTH / 2, HEIGHT / 2);
+    tap(TAB_WIDTH * view + TAB_WIDTH / 2, app::TAB_HEIGHT / 2);
+
+    std::vector<double> times;
+    for (int i = 0; i < frames; ++i) times.push_back(draw_frame());
+    std::sort(times.begin(), times.end());
+    double total = 0;
+    for (double t : times) total += t;
+    printf("%d frames: %.3f ms mean, %.3f ms median, %.3f ms min\n",
+           frames, total / frames, times[frames / 2], times[0]);
+
+    int status = 0;
+    std::vector<uint8_t> rgb = screen_rgb();
+    if (out_path && !write_ppm(out_path, rgb)) {
+        fprintf(stderr, "could not write %s\n", out_path);
+        status = 1;
+    }
+    if (golden_path) {
+        std::vector<uint8_t> golden;
+        if (!read_ppm(golden_path, golden)) {
+            fprintf(stderr, "could not read %s\n", golden_path);
+            status = 1;
+        }
+        else {
+            int diff = 0;
+            for (size_t i = 0; i < rgb.size(); i += 3) diff += memcmp(&rgb[i], &golden[i], 3) != 0;
+            printf("%d pixels differ from %s\n", diff, golden_path);
+            if (diff > 0) status = 1;
+        }
+    }
+
+    app::free();
+    fs::remove_all(storage_dir, ec);
+    return status;
+}
@@ -0,0 +1,259 @@
+#include "gtcompact.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+
+namespace gt {
+namespace {
+
+// FNV-1a, only used to find candidates, which are then compared in full
+struct Hash {
+    uint64_t h = 14695981039346656037ull;
+    void add(void const* data, size_t len) {
+        for (size_t i = 0; i < len; ++i) h = (h ^ ((uint8_t const*) data)[i]) * 1099511628211ull;
+    }
+};
+
+// finds the first equal item seen so far, or adds a new one
+template <class T>
+class Dedup {
+public:
+    template <class Equal>
+    int find_or_add(uint64_t hash, T const& item, Equal equal) {
+        std::vector<int>& bucket = m_buckets[hash];
+        for (int i : bucket) {
+            if (equal(m_items[i], item)) return i;
+        }
+        bucket.push_back(m_items.size());
+        m_items.push_back(item);
+        return m_items.size() - 1;
+    }
+    std::vector<T> const& items() const { return m_items; }
+private:
+    std::unordered_map<uint64_t, std::vector<int>> m_buckets;
+    std::vector<T>                                 m_items;
+};
+
+
+size_t saved_size(Song& song) {
+    std::ostringstream stream;
+    song.save(stream);
+    return stream.str().size();
+}
+
+bool is_empty(Pattern const& patt) {
+    for (int r = 0; r < patt.len; ++r) {
+        PatternRow row = patt.rows[r];
+        if (row.note != REST || row.instr || row.command) return false;
+    }
+    return true;
+}
+
+bool is_ptr_command(int cmd) {
+    return cmd >= CMD_SETWAVEPTR && cmd <= CMD_SETFILTERPTR;
+}
+
+// wave table commands that point to an instrument, as in Song::save
+bool is_wave_ptr_command(uint8_t lval) {
+    if ((lval & 0xf0) != 0xf0) return false;
+    int cmd = lval & 0xf;
+    return cmd >= CMD_SETPULSEPTR && cmd <= CMD_SETFILTERPTR;
+}
+
+
+void compact_patterns(Song& song, CompactReport& report) {
+    std::array<bool, MAX_PATT> used = {};
+    for (auto const& order : song.song_order) {
+        for (int r = 0; r < song.song_len; ++r) {
+            if (order[r].pattnum < MAX_PATT) used[order[r].pattnum] = true;
+        }
+    }
+
+    // referenced patterns keep their relative order
+    Dedup<Pattern> dedup;
+    std::array<int, MAX_PATT> mapping = {};
+    for (int i = 0; i < MAX_PATT; ++i) {
+        Pattern const& patt = song.patterns[i];
+        if (!used[i]) {
+            if (!is_empty(patt)) ++report.patterns_dropped;
+            continue;
+        }
+        // rows past the end are not part of the pattern
+        Pattern p;
+        p.len = patt.len;
+        std::copy(patt.rows.begin(), patt.rows.begin() + patt.len, p.rows.begin());
+        Hash h;
+        h.add(&p.len, sizeof(p.len));
+        h.add(p.rows.data(), sizeof(PatternRow) * p.len);
+        int count = dedup.items().size();
+        mapping[i] = dedup.find_or_add(h.h, p, [](Pattern const& a, Pattern const& b) {
+            return memcmp(&a, &b, sizeof(Pattern)) == 0;
+        });
+        if (mapping[i] < count) ++report.patterns_merged;
+    }
+
+    song.patterns = {};
+    std::copy(dedup.items().begin(), dedup.items().end(), song.patterns.begin());
+    for (auto& order : song.song_order) {
+        for (int r = 0; r < MAX_SONG_ROWS; ++r) {
+            if (r < song.song_len) order[r].pattnum = mapping[order[r].pattnum];
+            else order[r] = {};
+        }
+    }
+}
+
+
+void compact_instruments(Song& song, CompactReport& report) {
+    std::array<bool, MAX_INSTR> used = {};
+    used[1] = true;
+    for (Pattern const& patt : song.patterns) {
+        for (int r = 0; r < patt.len; ++r) {
+            PatternRow row = patt.rows[r];
+            if (row.instr < MAX_INSTR) used[row.instr] = true;
+            if (is_ptr_command(row.command) && row.data < MAX_INSTR) used[row.data] = true;
+        }
+    }
+    for (int i = 0; i < MAX_TABLELEN; ++i) {
+        if (is_wave_ptr_command(song.ltable[WTBL][i]) && song.rtable[WTBL][i] < MAX_INSTR) {
+            used[song.rtable[WTBL][i]] = true;
+        }
+    }
+
+    // an instrument's vibrato lives in its own row of the speed table
+    struct Entry {
+        Instrument instr;
+        uint8_t    vib_l;
+        uint8_t    vib_r;
+    };
+    auto entry_equal = [](Entry const& a, Entry const& b) {
+        return memcmp(&a.instr, &b.instr, sizeof(Instrument)) == 0 && a.vib_l == b.vib_l && a.vib_r == b.vib_r;
+    };
+    Dedup<Entry> dedup;
+    std::array<int, MAX_INSTR> mapping = {};
+    for (int i = 1; i < MAX_INSTR; ++i) {
+        Instrument const& instr = song.instruments[i];
+        if (!used[i]) {
+            bool set = instr.ptr[WTBL] | instr.ptr[PTBL] | instr.ptr[FTBL] || instr.name[0];
+            if (set) ++report.instruments_dropped;
+            continue;
+        }
+        Entry e = { instr, 0, 0 };
+        e.instr.ptr[STBL] = 0;
+        if (instr.ptr[STBL] > 0) {
+            e.vib_l = song.ltable[STBL][instr.ptr[STBL] - 1];
+            e.vib_r = song.rtable[STBL][instr.ptr[STBL] - 1];
+        }
+        Hash h;
+        h.add(&e.instr, sizeof(Instrument));
+        h.add(&e.vib_l, 1);
+        h.add(&e.vib_r, 1);
+        // instrument 1 comes first, so it keeps its slot
+        int count = dedup.items().size();
+        mapping[i] = dedup.find_or_add(h.h, e, entry_equal) + 1;
+        if (mapping[i] <= count) ++report.instruments_merged;
+    }
+
+    for (int i = 1; i < MAX_INSTR; ++i) {
+        Instrument& instr = song.instruments[i];
+        instr = {};
+        instr.ptr[STBL] = 0x80 + i;
+        song.ltable[STBL][0x80 + i - 1] = 0;
+        song.rtable[STBL][0x80 + i - 1] = 0;
+        if (i - 1 >= int(dedup.items().size())) continue;
+        Entry const& e = dedup.items()[i - 1];
+        instr = e.instr;
+        instr.ptr[STBL] = 0x80 + i;
+        song.ltable[STBL][0x80 + i - 1] = e.vib_l;
+        song.rtable[STBL][0x80 + i - 1] = e.vib_r;
+    }
+    for (Pattern& patt : song.patterns) {
+        for (int r = 0; r < patt.len; ++r) {
+            PatternRow& row = patt.rows[r];
+            row.instr = mapping[row.instr];
+            if (is_ptr_command(row.command)) row.data = mapping[row.data];
+        }
+    }
+    for (int i = 0; i < MAX_TABLELEN; ++i) {
+        if (is_wave_ptr_command(song.ltable[WTBL][i])) song.rtable[WTBL][i] = mapping[song.rtable[WTBL][i]];
+    }
+}
+
+
+// Table parts run from an instrument's pointer to the next jump row, and may
+// only jump back into themselves. Tables that don't follow this are left alone.
+void compact_table(Song& song, int t, CompactReport& report) {
+    auto const& ltable = song.ltable[t];
+    auto const& rtable = song.rtable[t];
+    std::array<int, MAX_TABLELEN> part_start;
+    part_start.fill(-1);
+
+    struct Part {
+        std::vector<uint8_t> l;
+        std::vector<uint8_t> r; // jump target is relative to the part start
+    };
+    Dedup<Part> dedup;
+    std::array<int, MAX_INSTR> mapping = {};
+    for (int i = 1; i < MAX_INSTR; ++i) {
+        int start = song.instruments[i].ptr[t] - 1;
+        if (start < 0) continue;
+        int end = start;
+        while (end < MAX_TABLELEN && ltable[end] != 0xff) ++end;
+        if (end == MAX_TABLELEN) return;
+        int jump = rtable[end];
+        if (jump != 0 && (jump - 1 < start || jump - 1 > end)) return;
+        for (int r = start; r <= end; ++r) {
+            if (part_start[r] >= 0 && part_start[r] != start) return; // overlapping parts
+            part_start[r] = start;
+        }
+
+        Part p;
+        p.l.assign(ltable.begin() + start, ltable.begin() + end + 1);
+        p.r.assign(rtable.begin() + start, rtable.begin() + end + 1);
+        p.r.back() = jump == 0 ? 0 : jump - start;
+        Hash h;
+        h.add(p.l.data(), p.l.size());
+        h.add(p.r.data(), p.r.size());
+        mapping[i] = dedup.find_or_add(h.h, p, [](Part const& a, Part const& b) {
+            return a.l == b.l && a.r == b.r;
+        });
+    }
+
+    int old_len = song.get_table_length(t);
+    std::vector<int> new_start;
+    std::array<uint8_t, MAX_TABLELEN> l = {};
+    std::array<uint8_t, MAX_TABLELEN> r = {};
+    int pos = 0;
+    for (Part const& p : dedup.items()) {
+        new_start.push_back(pos);
+        std::copy(p.l.begin(), p.l.end(), l.begin() + pos);
+        std::copy(p.r.begin(), p.r.end(), r.begin() + pos);
+        if (r[pos + p.r.size() - 1] != 0) r[pos + p.r.size() - 1] += pos;
+        pos += p.l.size();
+    }
+    for (int i = 1; i < MAX_INSTR; ++i) {
+        Instrument& instr = song.instruments[i];
+        if (instr.ptr[t] > 0) instr.ptr[t] = new_start[mapping[i]] + 1;
+    }
+    song.ltable[t] = l;
+    song.rtable[t] = r;
+    report.table_rows_dropped += old_len - song.get_table_length(t);
+}
+
+} // namespace
+
+
+CompactReport compact(Song& song) {
+    CompactReport report = {};
+    report.size_before = saved_size(song);
+    compact_patterns(song, report);
+    compact_instruments(song, report);
+    for (int t = WTBL; t <= FTBL; ++t) compact_table(song, t, report);
+    report.size_after = saved_size(song);
+    return report;
+}
+
+} // namespace gt
@@ -0,0 +1,24 @@
+#pragma once
+#include "gtsong.hpp"
+#include <cstddef>
+
+
+namespace gt {
+
+struct CompactReport {
+    size_t size_before; // bytes in the saved song
+    size_t size_after;
+    int    patterns_merged;
+    int    patterns_dropped;
+    int    instruments_merged;
+    int    instruments_dropped;
+    int    table_rows_dropped;
+};
+
+// Merge identical patterns, instruments and table parts, drop what nothing
+// refers to, and renumber the rest in order. Order lists, instruments and
+// table ptr commands are remapped, so the song plays the same.
+// Instrument 1 keeps its slot since the player reads its gate timer.
+CompactReport compact(Song& song);
+
+} // namespace gt
@@ -0,0 +1,402 @@
+// Renders whole song directories to WAV or OGG, e.g. for previews.
+// With -f sng the songs are compacted instead, see gt::compact. With --light
+// they are rendered with LiteSid, which is much faster but only close to reSID.
+//
+//   gtconvert [-f wav|ogg|sng] [-j threads] [-o out_dir] [--force] [--light] (dir | glob | file)...
+//
+// Songs are spread across a work-stealing thread pool. Each worker owns its
+// own song, player, SID and mixer, so workers share nothing but the queues.
+// A song is skipped if its output exists and was rendered from the same
+// song data and settings, according to the hash file in the output dir.
+#include "gtcompact.hpp"
+#include "gtplayer.hpp"
+#include "gtsong.hpp"
+#include "mapped_file.hpp"
+#include "mixer.hpp"
+#include "sha256.hpp"
+#include "sid.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glob.h>
+#include <sndfile.h>
+
+
+namespace fs = std::filesystem;
+
+namespace {
+
+enum {
+    // bump when the rendering changes, so old outputs are not up to date anymore
+    RENDER_VERSION       = 1,
+    REGISTER_WRITE_ORDER = 1, // v2.73, the app's default
+    BUFFER_SIZE          = 4096,
+};
+
+constexpr Sid::SamplingMethod SAMPLING_METHOD = Sid::SamplingMethod::ResampleInterpolate;
+constexpr char const*         HASH_FILE_NAME  = ".gtconvert";
+
+enum class Status { Pending, Skipped, Done, Failed };
+enum class Format { Wav, Ogg, Sng };
+
+constexpr char const* FORMAT_NAMES[] = { "wav", "ogg", "sng" };
+
+struct Job {
+    fs::path             song_path;
+    fs::path             out_path;
+    std::vector<uint8_t> data;
+    std::string          hash;
+    Status               status = Status::Pending;
+    std::string          error;
+    double               duration    = 0; // seconds of audio
+    double               render_time = 0; // seconds
+    size_t               size_before = 0; // bytes, when compacting
+    size_t               size_after  = 0;
+};
+
+struct Worker {
+    std::mutex      mutex;
+    std::deque<int> jobs;
+    gt::Song        song;
+    gt::Player      player{ song };
+    Sid             sid;
+    Mixer           mixer{ player, sid };
+};
+
+Format                               g_format;
+Sid::Engine                          g_engine = Sid::Engine::ReSid;
+std::vector<Job>                     g_jobs;
+std::vector<std::unique_ptr<Worker>> g_workers;
+std::mutex                           g_print_mutex;
+
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+std::string content_hash(std::vector<uint8_t> data) {
+    char const* format = FORMAT_NAMES[int(g_format)];
+    data.insert(data.end(), format, format + 4);
+    data.push_back(RENDER_VERSION);
+    data.push_back(REGISTER_WRITE_ORDER);
+    data.push_back(int(SAMPLING_METHOD));
+    data.push_back(int(g_engine));
+    uint8_t digest[32];
+    sha256::sha256(data.data(), data.size(), digest);
+    std::string hex;
+    for (uint8_t b : digest) {
+        char s[3];
+        snprintf(s, sizeof(s), "%02x", b);
+        hex += s;
+    }
+    return hex;
+}
+
+// the hash file has a line "<hash> <output file name>" per output
+std::map<std::string, std::string> read_hashes(fs::path const& path) {
+    std::map<std::string, std::string> hashes;
+    std::ifstream f(path);
+    std::string hash, name;
+    while (f >> hash && std::getline(f >> std::ws, name)) hashes[name] = hash;
+    return hashes;
+}
+
+bool write_hashes(fs::path const& path, std::map<std::string, std::string> const& hashes) {
+    std::ostringstream stream;
+    for (auto const& p : hashes) stream << p.second << ' ' << p.first << '\n';
+    std::string data = stream.str();
+    return write_file_atomic(path.c_str(), data.data(), data.size());
+}
+
+bool read_file(fs::path const& path, std::vector<uint8_t>& data) {
+    std::ifstream f(path, std::ios::binary | std::ios::ate);
+    if (!f.is_open()) return false;
+    data.resize(f.tellg());
+    f.seekg(0);
+    return bool(f.read((char*) data.data(), data.size()));
+}
+
+// a directory, a glob pattern or a file
+std::vector<fs::path> expand_input(std::string const& arg) {
+    std::vector<fs::path> paths;
+    std::error_code ec;
+    if (fs::is_directory(arg, ec)) {
+        for (auto const& entry : fs::directory_iterator(arg, ec)) {
+            if (entry.is_regular_file() && entry.path().extension() == ".sng") paths.push_back(entry.path());
+        }
+    }
+    else {
+        glob_t g;
+        if (glob(arg.c_str(), 0, nullptr, &g) == 0) {
+            for (size_t i = 0; i < g.gl_pathc; ++i) paths.emplace_back(g.gl_pathv[i]);
+        }
+        globfree(&g);
+    }
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+
+bool compact(Worker& w, Job& job) {
+    gt::CompactReport report = gt::compact(w.song);
+    job.size_before = report.size_before;
+    job.size_after  = report.size_after;
+    std::ostringstream stream;
+    w.song.save(stream);
+    std::string data = stream.str();
+    if (!write_file_atomic(job.out_path.c_str(), data.data(), data.size())) {
+        job.error = "cannot write " + job.out_path.string();
+        return false;
+    }
+    return true;
+}
+
+bool render(Worker& w, Job& job) {
+    try {
+        w.song.load(job.data.data(), job.data.size());
+    }
+    catch (gt::LoadError const& e) {
+        job.error = e.msg;
+        return false;
+    }
+    if (g_format == Format::Sng) return compact(w, job);
+
+    int samples  = song_length(w.song);
+    job.duration = double(samples) / Sid::MIXRATE;
+
+    SF_INFO info = { 0, Sid::MIXRATE, 1 };
+    info.format = g_format == Format::Ogg ? SF_FORMAT_OGG | SF_FORMAT_VORBIS : SF_FORMAT_WAV | SF_FORMAT_PCM_16;
+    // render to a temporary file, so an interrupted run leaves no truncated output
+    fs::path tmp_path = job.out_path.string() + ".tmp";
+    SNDFILE* sndfile = sf_open(tmp_path.c_str(), SFM_WRITE, &info);
+    if (!sndfile) {
+        job.error = sf_strerror(nullptr);
+        return false;
+    }
+    sf_set_string(sndfile, SF_STR_TITLE, w.song.song_name.data());
+    sf_set_string(sndfile, SF_STR_ARTIST, w.song.author_name.data());
+
+    w.player = gt::Player(w.song);
+    w.player.set_action(gt::Player::Action::Start);
+    w.sid.init(Sid::Model(w.song.model), SAMPLING_METHOD, g_engine);
+    w.mixer.reset();
+    w.mixer.set_register_write_order(REGISTER_WRITE_ORDER);
+
+    std::array<int16_t, BUFFER_SIZE> buffer;
+    bool ok = true;
+    for (int samples_left = samples; samples_left > 0 && ok;) {
+        int len = std::min<int>(samples_left, buffer.size());
+        samples_left -= len;
+        w.mixer.mix(buffer.data(), len);
+        ok = sf_writef_short(sndfile, buffer.data(), len) == len;
+    }
+    if (!ok) job.error = sf_strerror(sndfile);
+    sf_close(sndfile);
+
+    std::error_code ec;
+    if (ok) {
+        fs::rename(tmp_path, job.out_path, ec);
+        if (ec) job.error = ec.message();
+    }
+    if (!ok || ec) {
+        fs::remove(tmp_path, ec);
+        return false;
+    }
+    return true;
+}
+
+
+// take a job from the front of our own queue, or steal one from the back of another
+int take_job(int worker) {
+    int count = g_workers.size();
+    for (int i = 0; i < count; ++i) {
+        Worker& w = *g_workers[(worker + i) % count];
+        std::lock_guard<std::mutex> lock(w.mutex);
+        if (w.jobs.empty()) continue;
+        int job;
+        if (i == 0) {
+            job = w.jobs.front();
+            w.jobs.pop_front();
+        }
+        else {
+            job = w.jobs.back();
+            w.jobs.pop_back();
+        }
+        return job;
+    }
+    return -1;
+}
+
+void work(int worker) {
+    Worker& w = *g_workers[worker];
+    for (int j; (j = take_job(worker)) >= 0;) {
+        Job& job = g_jobs[j];
+        auto start = std::chrono::steady_clock::now();
+        bool ok = render(w, job);
+        job.render_time = seconds_since(start);
+        job.status      = ok ? Status::Done : Status::Failed;
+
+        std::lock_guard<std::mutex> lock(g_print_mutex);
+        if (ok && g_format == Format::Sng) {
+            printf("%-40s %6zu -> %6zu bytes\n", job.song_path.filename().c_str(), job.size_before, job.size_after);
+        }
+        else if (ok) {
+            printf("%-40s %7.1f s  %6.1fx realtime\n",
+                   job.song_path.filename().c_str(), job.duration, job.duration / job.render_time);
+        }
+        else {
+            printf("%-40s FAILED: %s\n", job.song_path.filename().c_str(), job.error.c_str());
+        }
+        fflush(stdout);
+    }
+}
+
+
+void usage(char const* name) {
+    fprintf(stderr, "usage: %s [-f wav|ogg|sng] [-j threads] [-o out_dir] [--force] [--light] (dir | glob | file)...\n", name);
+}
+
+} // namespace
+
+
+int main(int argc, char** argv) {
+    fs::path                 out_dir = ".";
+    int                      thread_count = std::max(1u, std::thread::hardware_concurrency());
+    bool                     force = false;
+    std::vector<std::string> inputs;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "-f" && has_value) {
+            std::string format = argv[++i];
+            auto it = std::find(std::begin(FORMAT_NAMES), std::end(FORMAT_NAMES), format);
+            if (it == std::end(FORMAT_NAMES)) {
+                usage(argv[0]);
+                return 1;
+            }
+            g_format = Format(it - std::begin(FORMAT_NAMES));
+        }
+        else if (arg == "-j" && has_value) thread_count = std::max(1, atoi(argv[++i]));
+        else if (arg == "-o" && has_value) out_dir = argv[++i];
+        else if (arg == "--force") force = true;
+        else if (arg == "--light") g_engine = Sid::Engine::Lite;
+        else if (arg[0] == '-') {
+            usage(argv[0]);
+            return 1;
+        }
+        else inputs.push_back(arg);
+    }
+    if (inputs.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::error_code ec;
+    fs::create_directories(out_dir, ec);
+    fs::path hash_path = out_dir / HASH_FILE_NAME;
+    std::map<std::string, std::string> hashes = read_hashes(hash_path);
+
+    // collect jobs
+    int failed = 0;
+    for (std::string const& input : inputs) {
+        std::vector<fs::path> paths = expand_input(input);
+        if (paths.empty()) {
+            printf("%-40s FAILED: no songs found\n", input.c_str());
+            ++failed;
+        }
+        for (fs::path const& path : paths) {
+            Job job;
+            job.song_path = path;
+            job.out_path  = out_dir / path.filename().replace_extension(std::string(".") + FORMAT_NAMES[int(g_format)]);
+            if (fs::equivalent(job.out_path, path, ec)) {
+                printf("%-40s FAILED: output would replace the song\n", path.c_str());
+                ++failed;
+                continue;
+            }
+            bool duplicate = std::any_of(g_jobs.begin(), g_jobs.end(), [&](Job const& j) {
+                return j.out_path == job.out_path;
+            });
+            if (duplicate) {
+                printf("%-40s FAILED: output name already used by another song\n", path.c_str());
+                ++failed;
+                continue;
+            }
+            if (!read_file(path, job.data)) {
+                printf("%-40s FAILED: cannot read file\n", path.c_str());
+                ++failed;
+                continue;
+            }
+            job.hash = content_hash(job.data);
+            std::string out_name = job.out_path.filename().string();
+            auto it = hashes.find(out_name);
+            if (!force && it != hashes.end() && it->second == job.hash && fs::exists(job.out_path, ec)) {
+                job.status = Status::Skipped;
+            }
+            g_jobs.push_back(std::move(job));
+        }
+    }
+
+    // deal the songs out biggest first, so long songs don't end up last
+    std::vector<int> order;
+    for (int i = 0; i < int(g_jobs.size()); ++i) {
+        if (g_jobs[i].status == Status::Pending) order.push_back(i);
+    }
+    std::stable_sort(order.begin(), order.end(), [](int a, int b) {
+        return g_jobs[a].data.size() > g_jobs[b].data.size();
+    });
+    thread_count = std::max(1, std::min<int>(thread_count, order.size()));
+    for (int i = 0; i < thread_count; ++i) g_workers.push_back(std::make_unique<Worker>());
+    for (int i = 0; i < int(order.size()); ++i) g_workers[i % thread_count]->jobs.push_back(order[i]);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < thread_count; ++i) threads.emplace_back(work, i);
+    for (std::thread& t : threads) t.join();
+    double wall_time = seconds_since(start);
+
+    int    done     = 0;
+    int    skipped  = 0;
+    double duration = 0;
+    size_t size_before = 0;
+    size_t size_after  = 0;
+    for (Job const& job : g_jobs) {
+        std::string out_name = job.out_path.filename().string();
+        if (job.status == Status::Skipped) ++skipped;
+        if (job.status == Status::Failed) {
+            ++failed;
+            hashes.erase(out_name);
+        }
+        if (job.status == Status::Done) {
+            ++done;
+            duration    += job.duration;
+            size_before += job.size_before;
+            size_after  += job.size_after;
+            hashes[out_name] = job.hash;
+        }
+    }
+    if (done > 0 && !write_hashes(hash_path, hashes)) {
+        printf("WARN:  could not write %s\n", hash_path.c_str());
+    }
+
+    printf("\n%d converted, %d up to date, %d failed\n", done, skipped, failed);
+    if (done > 0 && g_format == Format::Sng) {
+        printf("%zu -> %zu bytes\n", size_before, size_after);
+    }
+    else if (done > 0) {
+        printf("%.1f s of audio in %.1f s on %d threads, %.1fx realtime\n",
+               duration, wall_time, thread_count, duration / wall_time);
+    }
+    return failed > 0 ? 1 : 0;
+}
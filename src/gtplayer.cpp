@@ -46,6 +46,7 @@ void Player::reset() {
     m_action           = Action::None;
     m_is_playing       = false;
     m_loop_pattern     = false;
+    m_pending_notes    = 0;
 
     m_start_song_pos   = {};
     m_start_patt_pos   = {};
@@ -73,29 +74,43 @@ void Player::reset() {
 void Player::release_note(int chnnum) {
     m_channels[chnnum].gate    = 0xfe;
     m_channels[chnnum].newnote = 0;
+    m_pending_notes           |= 1 << chnnum;
 }
 
-void Player::play_test_note(int note, int ins, int chnnum) {
+void Player::play_test_note(Song const& song, int note, int ins, int chnnum) {
     if (note == KEYON) return;
     if (note == REST || note == KEYOFF) {
         release_note(chnnum);
         return;
     }
 
-    if (!(m_song->instruments[ins].gatetimer & 0x40)) {
+    if (!(song.instruments[ins].gatetimer & 0x40)) {
         m_channels[chnnum].gate = 0xfe; // keyoff
-        if (!(m_song->instruments[ins].gatetimer & 0x80)) {
-            m_regs[0x5 + chnnum * 7] = m_song->adparam >> 8; // hardrestart
-            m_regs[0x6 + chnnum * 7] = m_song->adparam & 0xff;
+        if (!(song.instruments[ins].gatetimer & 0x80)) {
+            m_regs[0x5 + chnnum * 7] = song.adparam >> 8; // hardrestart
+            m_regs[0x6 + chnnum * 7] = song.adparam & 0xff;
         }
     }
 
     m_channels[chnnum].instr   = ins;
     m_channels[chnnum].newnote = note;
-    if (!m_is_playing) {
-        m_channels[chnnum].tick      = (m_song->instruments[ins].gatetimer & 0x3f) + 1;
-        m_channels[chnnum].gatetimer = m_song->instruments[ins].gatetimer & 0x3f;
+    m_pending_notes           |= 1 << chnnum;
+}
+
+// Runs the tick 0 note init for a pending test note or release right away,
+// instead of waiting for the channel's next tick 0, so the hard restart
+// gets no ticks of its own. The channel keeps its place in the song.
+bool Player::start_note(int chnnum) {
+    Channel& chan = m_channels[chnnum];
+    m_pending_notes &= ~(1 << chnnum);
+    bool hard_restart = chan.gate == 0xfe;
+    if (chan.newnote) {
+        chan.gatetimer = m_song->instruments[chan.instr].gatetimer & 0x3f;
+        init_note(chnnum);
+        chan.newnote = 0;
     }
+    set_channel_registers(chnnum);
+    return hard_restart && (m_regs[0x4 + 7 * chnnum] & 0x01);
 }
 
 
@@ -277,52 +292,7 @@ TICK0:
         chan.gatetimer = instr.gatetimer & 0x3f;
 
         // new note init
-        if (chan.newnote) {
-            chan.note     = chan.newnote - FIRSTNOTE;
-            chan.command  = 0;
-            chan.vibdelay = instr.vibdelay;
-            chan.cmddata  = instr.ptr[STBL];
-            if (chan.newcommand != CMD_TONEPORTA) {
-                if (instr.firstwave) {
-                    if (instr.firstwave >= 0xfe) chan.gate = instr.firstwave;
-                    else {
-                        chan.wave = instr.firstwave;
-                        chan.gate = 0xff;
-                    }
-                }
-
-                chan.ptr[WTBL] = instr.ptr[WTBL];
-
-                if (chan.ptr[WTBL]) {
-                    // stop the song in case of jumping into a jump
-                    if (m_song->ltable[WTBL][chan.ptr[WTBL] - 1] == 0xff) {
-                        m_action = Action::None;
-                    }
-                }
-                if (instr.ptr[PTBL]) {
-                    chan.ptr[PTBL] = instr.ptr[PTBL];
-                    chan.pulsetime = 0;
-                    if (chan.ptr[PTBL]) {
-                        // stop the song in case of jumping into a jump
-                        if (m_song->ltable[PTBL][chan.ptr[PTBL] - 1] == 0xff) {
-                            m_action = Action::None;
-                        }
-                    }
-                }
-                if (instr.ptr[FTBL]) {
-                    m_filterptr  = instr.ptr[FTBL];
-                    m_filtertime = 0;
-                    if (m_filterptr) {
-                        // stop the song in case of jumping into a jump
-                        if (m_song->ltable[FTBL][m_filterptr - 1] == 0xff) {
-                            m_action = Action::None;
-                        }
-                    }
-                }
-                m_regs[0x5 + 7 * c] = instr.ad;
-                m_regs[0x6 + 7 * c] = instr.sr;
-            }
-        }
+        if (chan.newnote) init_note(c);
 
         // tick 0 effects
 
@@ -747,16 +717,71 @@ GETNEWNOTES:
             }
         }
 NEXTCHN:
-        m_regs[0x0 + 7 * c] = chan.freq & 0xff;
-        m_regs[0x1 + 7 * c] = chan.freq >> 8;
-        m_regs[0x2 + 7 * c] = chan.pulse & 0xfe;
-        m_regs[0x3 + 7 * c] = chan.pulse >> 8;
-        if (chan.mute) {
-            m_regs[0x4 + 7 * c] = chan.wave & 0x08; // don't set test bit every time
+        set_channel_registers(c);
+    }
+}
+
+
+void Player::init_note(int c) {
+    Channel&          chan  = m_channels[c];
+    Instrument const& instr = m_song->instruments[chan.instr];
+    chan.note     = chan.newnote - FIRSTNOTE;
+    chan.command  = 0;
+    chan.vibdelay = instr.vibdelay;
+    chan.cmddata  = instr.ptr[STBL];
+    if (chan.newcommand != CMD_TONEPORTA) {
+        if (instr.firstwave) {
+            if (instr.firstwave >= 0xfe) chan.gate = instr.firstwave;
+            else {
+                chan.wave = instr.firstwave;
+                chan.gate = 0xff;
+            }
+        }
+
+        chan.ptr[WTBL] = instr.ptr[WTBL];
+
+        if (chan.ptr[WTBL]) {
+            // stop the song in case of jumping into a jump
+            if (m_song->ltable[WTBL][chan.ptr[WTBL] - 1] == 0xff) {
+                m_action = Action::None;
+            }
         }
-        else {
-            m_regs[0x4 + 7 * c] = chan.wave & chan.gate;
+        if (instr.ptr[PTBL]) {
+            chan.ptr[PTBL] = instr.ptr[PTBL];
+            chan.pulsetime = 0;
+            if (chan.ptr[PTBL]) {
+                // stop the song in case of jumping into a jump
+                if (m_song->ltable[PTBL][chan.ptr[PTBL] - 1] == 0xff) {
+                    m_action = Action::None;
+                }
+            }
         }
+        if (instr.ptr[FTBL]) {
+            m_filterptr  = instr.ptr[FTBL];
+            m_filtertime = 0;
+            if (m_filterptr) {
+                // stop the song in case of jumping into a jump
+                if (m_song->ltable[FTBL][m_filterptr - 1] == 0xff) {
+                    m_action = Action::None;
+                }
+            }
+        }
+        m_regs[0x5 + 7 * c] = instr.ad;
+        m_regs[0x6 + 7 * c] = instr.sr;
+    }
+}
+
+void Player::set_channel_registers(int c) {
+    Channel const& chan = m_channels[c];
+    m_regs[0x0 + 7 * c] = chan.freq & 0xff;
+    m_regs[0x1 + 7 * c] = chan.freq >> 8;
+    m_regs[0x2 + 7 * c] = chan.pulse & 0xfe;
+    m_regs[0x3 + 7 * c] = chan.pulse >> 8;
+    if (chan.mute) {
+        m_regs[0x4 + 7 * c] = chan.wave & 0x08; // don't set test bit every time
+    }
+    else {
+        m_regs[0x4 + 7 * c] = chan.wave & chan.gate;
     }
 }
 
@@ -31,8 +31,15 @@ public:
     bool get_pattern_looping() const { return m_loop_pattern; }
     void set_pattern_loopping(bool loop) { m_loop_pattern = loop; }
 
-    void play_test_note(int note, int ins, int chnnum);
+    // called from the UI thread, so it reads the instrument from the song being edited,
+    // not from the version the audio thread set
+    void play_test_note(Song const& song, int note, int ins, int chnnum);
     void release_note(int chnnum);
+    // set by test notes and releases until start_note picks them up
+    bool note_pending(int chnnum) const { return m_pending_notes & (1 << chnnum); }
+    // audio thread: start the channel's pending note now, returns whether the
+    // gate was closed for a hard restart and the SID needs to see it close
+    bool start_note(int chnnum);
 
     void set_channel_active(int chnnum, bool active) { m_channels[chnnum].mute = !active; }
     bool is_channel_active(int chnnum) const { return !m_channels[chnnum].mute; }
@@ -42,6 +49,7 @@ public:
     using Registers = std::array<uint8_t, 25>;
     Registers const& registers() const { return m_regs; }
     gt::Song const&  song() const { return *m_song; }
+    void             set_song(gt::Song const& song) { m_song = &song; }
 
     // used to calculate song length in ticks
     int channel_loop_counter(int c) const { return m_channels[c].loop_counter; }
@@ -54,6 +62,8 @@ public:
 private:
     void reset();
     void sequencer(int c, bool reset_current_patt_pos = true);
+    void init_note(int c);
+    void set_channel_registers(int c);
 
     struct Channel {
         uint8_t  trans;
@@ -94,6 +104,7 @@ private:
     Action          m_action;
     bool            m_is_playing;
     bool            m_loop_pattern;
+    uint8_t         m_pending_notes; // a bit per channel
 
 public:
     std::array<int, MAX_CHN> m_start_song_pos;
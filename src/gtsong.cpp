@@ -1,37 +1,26 @@
 #include "gtsong.hpp"
 
 #include "log.hpp"
+#include "mapped_file.hpp"
 
 #include <algorithm>
 #include <cassert>
 #include <cstddef>
 #include <cstdio>
 #include <cstring>
-#include <fstream>
+#include <sstream>
 #include <vector>
 
 namespace gt {
 namespace {
 
-template <class T>
-bool read(std::istream& stream, T& v) {
-    stream.read((char*) &v, sizeof(T));
-    return stream.good();
-}
-
-uint8_t read8(std::istream& stream) {
-    uint8_t b;
-    read(stream, b);
-    return b;
-}
-
 template <class T>
 bool write(std::ostream& stream, T const& v) {
     stream.write((char const*) &v, sizeof(T));
     return stream.good();
 }
 
-void load_error(std::string msg) {
+[[noreturn]] void load_error(std::string msg) {
     LOGE("Song::load: %s", msg.c_str());
     throw LoadError(std::move(msg));
 }
@@ -51,59 +40,52 @@ void Song::clear() {
 }
 
 void Song::load(char const* filename) {
-    std::ifstream stream(filename, std::ios::binary);
-    if (!stream.is_open()) load_error("Cannot open file");
-    load(stream);
+    MappedFile file;
+    if (!file.open(filename)) load_error("Cannot open file");
+    load(file.data(), file.size());
 }
 void Song::load(uint8_t const* data, size_t size) {
-    struct MemBuf : std::streambuf {
-        MemBuf(uint8_t const* data, size_t size) {
-            char* p = (char*) data;
-            this->setg(p, p, p + size);
-        }
-    } membuf(data, size);
-    std::istream stream(&membuf);
-    load(stream);
-}
-void Song::load(std::istream& stream) {
-    char ident[4];
-    read(stream, ident);
-    if (strncmp(ident, "GTS5", 4) != 0) {
+    Reader reader(data, size);
+    if (memcmp(reader.bytes(4), "GTS5", 4) != 0) {
         load_error("Bad file format");
     }
 
     clear();
-    read(stream, song_name);
-    read(stream, author_name);
-    read(stream, copyright_name);
+    reader.read(song_name);
+    reader.read(author_name);
+    reader.read(copyright_name);
 
     // read songorderlists
-    int amount = read8(stream);
+    int amount = reader.u8();
     if (amount != 1) load_error("Multiple songs not supported");
     for (int c = 0; c < MAX_CHN; c++) {
-        int buffer_len = read8(stream) + 1;
-        assert(buffer_len >= 3);
-        std::array<uint8_t, 256> buffer;
-        stream.read((char*) buffer.data(), buffer_len);
-
-        assert(buffer[buffer_len - 2] == LOOPSONG);
-        int loop  = buffer[buffer_len - 1];
-        int pos   = 0;
-        int trans = 0;
+        int buffer_len = reader.u8() + 1;
+        if (buffer_len < 3) load_error("Order list too short");
+        uint8_t const* buffer = reader.bytes(buffer_len);
+        if (buffer[buffer_len - 2] != LOOPSONG) load_error("Order list not terminated");
+
+        // the last two bytes are LOOPSONG and the loop position
+        int  loop  = buffer[buffer_len - 1];
+        int  pos   = 0;
+        int  trans = 0;
+        int  i     = 0;
+        auto next  = [&] {
+            if (i >= buffer_len - 2) load_error("Bad order list");
+            return buffer[i++];
+        };
         auto& order = song_order[c];
-        for (int i = 0; i < buffer_len;) {
-            uint8_t x = buffer[i++];
-            if (x == LOOPSONG) break;
+        while (buffer[i] != LOOPSONG) {
+            uint8_t x = next();
             // transpose
             if (x >= TRANSDOWN && x < LOOPSONG) {
                 if (i <= buffer[buffer_len - 1]) --loop;
                 trans = x - TRANSUP;
-                x = buffer[i++];
+                x = next();
             }
             int repeat = 1;
             if (x >= REPEAT && x < TRANSDOWN) {
                 repeat = x - REPEAT + 1;
-                x = buffer[i++];
+                x = next();
             }
             if (x >= MAX_PATT) {
                 load_error("Invalid pattern number");
@@ -118,6 +100,8 @@ void Song::load(std::istream& stream) {
             }
         }
         if (c == 0) {
+            if (pos == 0) load_error("Empty order list");
+            if (loop < 0 || loop >= pos) load_error("Bad order loop");
             song_len  = pos;
             song_loop = loop;
         }
@@ -128,33 +112,33 @@ void Song::load(std::istream& stream) {
     }
 
     // read instruments
-    int instr_count = read8(stream);
+    int instr_count = reader.u8();
+    if (instr_count >= MAX_INSTR) load_error("Too many instruments");
     for (int c = 1; c <= instr_count; c++) {
         Instrument& instr = instruments[c];
-        instr.ad = read8(stream);
-        instr.sr = read8(stream);
-        read(stream, instr.ptr);
-        instr.vibdelay  = read8(stream);
-        instr.gatetimer = read8(stream);
-        instr.firstwave = read8(stream);
-        read(stream, instr.name);
+        instr.ad = reader.u8();
+        instr.sr = reader.u8();
+        reader.read(instr.ptr);
+        instr.vibdelay  = reader.u8();
+        instr.gatetimer = reader.u8();
+        instr.firstwave = reader.u8();
+        reader.read(instr.name);
     }
     // read tables
     for (int c = 0; c < MAX_TABLES; c++) {
-        int len = read8(stream);
-        stream.read((char*) ltable[c].data(), len);
-        stream.read((char*) rtable[c].data(), len);
+        int len = reader.u8();
+        memcpy(ltable[c].data(), reader.bytes(len), len);
+        memcpy(rtable[c].data(), reader.bytes(len), len);
     }
     // read patterns
-    amount = read8(stream);
+    amount = reader.u8();
+    if (amount > MAX_PATT) load_error("Too many patterns");
     for (int c = 0; c < amount; c++) {
-        int len = read8(stream);
-        std::array<uint8_t, 1024> buffer;
-        stream.read((char*) buffer.data(), len * 4);
+        int len = reader.u8();
         Pattern& patt = patterns[c];
         patt.len = len - 1;
-        assert(patt.len > 0);
-        assert(patt.len <= int(patt.rows.size()));
+        if (patt.len <= 0 || patt.len > int(patt.rows.size())) load_error("Bad pattern length");
+        uint8_t const* buffer = reader.bytes(len * 4);
         int instr = 0;
         for (int i = 0; i < patt.len; ++i) {
             PatternRow row = {
@@ -163,6 +147,10 @@ void Song::load(std::istream& stream) {
                 buffer[i * 4 + 2],
                 buffer[i * 4 + 3],
             };
+            // the player and gtcompact index with these, ptr command data is remapped below
+            if (row.note < FIRSTNOTE || row.note > KEYON) load_error("Bad note");
+            if (row.instr >= MAX_INSTR) load_error("Bad instrument number");
+            if (row.command > CMD_SETTEMPO) load_error("Bad command");
             // add missing instr to notes
             if (row.instr > 0) instr = row.instr;
             else if (instr > 0 && row.note <= LASTNOTE) row.instr = instr;
@@ -171,11 +159,11 @@ void Song::load(std::istream& stream) {
     }
 
     // read extra stuff
-    read(stream, ident);
-    if (strncmp(ident, "GTM ", 4) == 0) {
-        read(stream, adparam);
-        read(stream, multiplier);
-        read(stream, model);
+    if (reader.left() >= 4 && memcmp(reader.bytes(4), "GTM ", 4) == 0) {
+        reader.read(adparam);
+        reader.read(multiplier);
+        reader.read(model);
+        if (model != Model::MOS6581 && model != Model::MOS8580) load_error("Bad chip model");
     }
 
 
@@ -329,6 +317,7 @@ void Song::load(std::istream& stream) {
             instr.ptr[t] = new_ptr[p] = nlt.size() + 1;
             std::array<int, MAX_TABLELEN> mark = {};
             for (;;) {
+                if (p > MAX_TABLELEN) load_error("Table runs past the end");
                 if (mark[p - 1] > 0) {
                     // loop
                     nlt.push_back(0xff);
@@ -361,10 +350,123 @@ void Song::load(std::istream& stream) {
 }
 
 
-bool Song::save(char const* filename) {
-    std::ofstream stream(filename, std::ios::binary);
-    if (!stream.is_open()) return false;
-    return save(stream);
+// a crash or full disk never leaves a truncated song behind
+bool Song::save(char const* filename) const {
+    std::ostringstream stream;
+    if (!save(stream)) return false;
+    std::string data = stream.str();
+    if (!write_file_atomic(filename, data.data(), data.size())) {
+        LOGE("Song::save: could not write %s", filename);
+        return false;
+    }
+    return true;
+}
+
+
+namespace {
+
+Pattern const EMPTY_PATTERN = {};
+
+template <class T>
+bool same(T const& a, T const& b) {
+    return memcmp(&a, &b, sizeof(T)) == 0;
+}
+
+template <class T>
+bool same_block(std::shared_ptr<T const> const& a, std::shared_ptr<T const> const& b) {
+    return a == b || (a && b && same(*a, *b));
+}
+
+// reuse the base block if the data did not change
+template <class T>
+std::shared_ptr<T const> share(T const& data, std::shared_ptr<T const> const* base) {
+    if (base && *base && same(**base, data)) return *base;
+    return std::make_shared<T const>(data);
+}
+
+} // namespace
+
+
+SongSnapshot::SongSnapshot(Song const& song, SongSnapshot const* base) {
+    m_instruments = share(song.instruments, base ? &base->m_instruments : nullptr);
+    for (int t = 0; t < MAX_TABLES; ++t) {
+        Table table = { song.ltable[t], song.rtable[t] };
+        m_tables[t] = share(table, base ? &base->m_tables[t] : nullptr);
+    }
+    for (int i = 0; i < MAX_PATT; ++i) {
+        if (same(song.patterns[i], EMPTY_PATTERN)) continue;
+        m_patterns[i] = share(song.patterns[i], base ? &base->m_patterns[i] : nullptr);
+    }
+    m_song_order     = song.song_order;
+    m_song_len       = song.song_len;
+    m_song_loop      = song.song_loop;
+    m_song_name      = song.song_name;
+    m_author_name    = song.author_name;
+    m_copyright_name = song.copyright_name;
+    m_adparam        = song.adparam;
+    m_multiplier     = song.multiplier;
+    m_model          = song.model;
+}
+
+void SongSnapshot::restore(Song& song) const {
+    song.instruments = *m_instruments;
+    for (int t = 0; t < MAX_TABLES; ++t) {
+        song.ltable[t] = (*m_tables[t])[0];
+        song.rtable[t] = (*m_tables[t])[1];
+    }
+    for (int i = 0; i < MAX_PATT; ++i) {
+        song.patterns[i] = m_patterns[i] ? *m_patterns[i] : EMPTY_PATTERN;
+    }
+    song.song_order     = m_song_order;
+    song.song_len       = m_song_len;
+    song.song_loop      = m_song_loop;
+    song.song_name      = m_song_name;
+    song.author_name    = m_author_name;
+    song.copyright_name = m_copyright_name;
+    song.adparam        = m_adparam;
+    song.multiplier     = m_multiplier;
+    song.model          = m_model;
+}
+
+bool SongSnapshot::operator==(Song const& song) const {
+    if (!m_instruments) return false;
+    if (!same(*m_instruments, song.instruments)) return false;
+    for (int t = 0; t < MAX_TABLES; ++t) {
+        if (!same((*m_tables[t])[0], song.ltable[t])) return false;
+        if (!same((*m_tables[t])[1], song.rtable[t])) return false;
+    }
+    for (int i = 0; i < MAX_PATT; ++i) {
+        if (!same(m_patterns[i] ? *m_patterns[i] : EMPTY_PATTERN, song.patterns[i])) return false;
+    }
+    return same(m_song_order, song.song_order)
+        && m_song_len == song.song_len
+        && m_song_loop == song.song_loop
+        && same(m_song_name, song.song_name)
+        && same(m_author_name, song.author_name)
+        && same(m_copyright_name, song.copyright_name)
+        && m_adparam == song.adparam
+        && m_multiplier == song.multiplier
+        && m_model == song.model;
+}
+
+bool SongSnapshot::operator==(SongSnapshot const& other) const {
+    if (!m_instruments || !other.m_instruments) return m_instruments == other.m_instruments;
+    if (!same_block(m_instruments, other.m_instruments)) return false;
+    for (int t = 0; t < MAX_TABLES; ++t) {
+        if (!same_block(m_tables[t], other.m_tables[t])) return false;
+    }
+    for (int i = 0; i < MAX_PATT; ++i) {
+        if (!same_block(m_patterns[i], other.m_patterns[i])) return false;
+    }
+    return same(m_song_order, other.m_song_order)
+        && m_song_len == other.m_song_len
+        && m_song_loop == other.m_song_loop
+        && same(m_song_name, other.m_song_name)
+        && same(m_author_name, other.m_author_name)
+        && same(m_copyright_name, other.m_copyright_name)
+        && m_adparam == other.m_adparam
+        && m_multiplier == other.m_multiplier
+        && m_model == other.m_model;
 }
 
 
@@ -393,7 +495,7 @@ int Song::get_table_part_length(int table, int start_row) const {
 }
 
 
-bool Song::save(std::ostream& stream) {
+bool Song::save(std::ostream& stream) const {
     assert(song_len <= MAX_SONG_ROWS);
 
     stream.write("GTS5", 4);
@@ -425,14 +527,14 @@ bool Song::save(std::ostream& stream) {
     // instruments
     int max_used_instr = 0;
     for (int i = 1; i < MAX_INSTR; i++) {
-        Instrument& instr = instruments[i];
+        Instrument const& instr = instruments[i];
         if ((instr.ptr[WTBL] | instr.ptr[PTBL] | instr.ptr[FTBL]) || strlen(instr.name.data()) > 0) {
             max_used_instr = i;
         }
     }
     write<uint8_t>(stream, max_used_instr);
     for (int i = 1; i <= max_used_instr; i++) {
-        Instrument& instr = instruments[i];
+        Instrument const& instr = instruments[i];
         write(stream, instr.ad);
         write(stream, instr.sr);
         write(stream, instr.ptr);
@@ -1,7 +1,9 @@
 #pragma once
 #include <cstdint>
-#include <istream>
+#include <cstring>
+#include <ostream>
 #include <array>
+#include <memory>
 #include <stdexcept>
 
 
@@ -110,6 +112,26 @@ struct LoadError : public std::exception {
     std::string msg;
 };
 
+// Reads from file data in place. Reading past the end throws a LoadError,
+// so truncated files are rejected in release builds too.
+class Reader {
+public:
+    Reader(uint8_t const* data, size_t size) : m_pos(data), m_end(data + size) {}
+    size_t left() const { return m_end - m_pos; }
+    uint8_t const* bytes(size_t n) {
+        if (left() < n) throw LoadError("Unexpected end of file");
+        uint8_t const* p = m_pos;
+        m_pos += n;
+        return p;
+    }
+    uint8_t u8() { return *bytes(1); }
+    template <class T>
+    void read(T& v) { memcpy(&v, bytes(sizeof(T)), sizeof(T)); }
+private:
+    uint8_t const* m_pos;
+    uint8_t const* m_end;
+};
+
 enum class Model : uint8_t { MOS6581, MOS8580 };
 
 struct Song {
@@ -135,11 +157,46 @@ struct Song {
 
     void load(char const* filename);
     void load(uint8_t const* data, size_t size);
-    void load(std::istream& stream);
-    bool save(char const* filename);
-    bool save(std::ostream& stream);
+    bool save(char const* filename) const;
+    bool save(std::ostream& stream) const;
     void clear();
 };
 
 
+// An immutable copy of a song for undo history and the like. Patterns,
+// tables and instruments are held in shared blocks, and blocks that did not
+// change since the base snapshot are reused, so a snapshot costs about as
+// much memory as the edits since its base. Empty patterns take no memory.
+// A default constructed snapshot is empty and must not be restored.
+class SongSnapshot {
+public:
+    SongSnapshot() = default;
+    explicit SongSnapshot(Song const& song, SongSnapshot const* base = nullptr);
+    void restore(Song& song) const;
+    bool operator==(Song const& song) const;
+    bool operator==(SongSnapshot const& other) const;
+    bool operator!=(Song const& song) const { return !(*this == song); }
+    bool operator!=(SongSnapshot const& other) const { return !(*this == other); }
+
+private:
+    using Instruments = std::array<Instrument, MAX_INSTR>;
+    using Table       = std::array<std::array<uint8_t, MAX_TABLELEN>, 2>; // left and right column
+
+    std::shared_ptr<Instruments const>                    m_instruments;
+    std::array<std::shared_ptr<Table const>, MAX_TABLES>  m_tables;
+    std::array<std::shared_ptr<Pattern const>, MAX_PATT>  m_patterns; // null if empty
+
+    // the rest of the song is small enough to copy
+    Array2<OrderRow, MAX_CHN, MAX_SONG_ROWS>              m_song_order;
+    int                                                   m_song_len;
+    int                                                   m_song_loop;
+    std::array<char, MAX_STR>                             m_song_name;
+    std::array<char, MAX_STR>                             m_author_name;
+    std::array<char, MAX_STR>                             m_copyright_name;
+    uint16_t                                              m_adparam;
+    uint8_t                                               m_multiplier;
+    Model                                                 m_model;
+};
+
+
 } // namespace gt
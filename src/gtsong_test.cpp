@@ -0,0 +1,88 @@
+// Feeds Song::load truncated and hostile files. Each one must either load
+// into a song the player can index safely, or throw a LoadError.
+#include "gtsong.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+namespace {
+
+int g_failures = 0;
+
+void check(bool ok, char const* what) {
+    if (ok) return;
+    printf("FAILED: %s\n", what);
+    ++g_failures;
+}
+
+// 0 if the data loads, 1 for a LoadError
+int load(std::vector<uint8_t> const& data, size_t size) {
+    static gt::Song song;
+    try {
+        song.load(data.data(), size);
+    }
+    catch (gt::LoadError const&) {
+        return 1;
+    }
+    // whatever loads must be safe to play
+    for (gt::Pattern const& patt : song.patterns) {
+        for (gt::PatternRow const& row : patt.rows) {
+            check(row.instr < gt::MAX_INSTR, "instrument in range");
+            check(row.command <= gt::CMD_SETTEMPO, "command in range");
+        }
+    }
+    check(song.song_len > 0 && song.song_len <= gt::MAX_SONG_ROWS, "song length in range");
+    check(song.song_loop >= 0 && song.song_loop < song.song_len, "song loop in range");
+    return 0;
+}
+
+} // namespace
+
+
+int main() {
+    static gt::Song song;
+    song.clear();
+    song.patterns[0].rows[0] = { gt::FIRSTNOTE + 12, 1, gt::CMD_SETAD, 0xa7 };
+    std::ostringstream stream;
+    song.save(stream);
+    std::string str = stream.str();
+    std::vector<uint8_t> data(str.begin(), str.end());
+
+    check(load(data, data.size()) == 0, "saved song loads");
+
+    // everything but the optional 8 byte "GTM " block at the end is required
+    for (size_t size = 0; size < data.size() - 8; ++size) {
+        if (load(data, size) != 1) {
+            printf("FAILED: truncated to %zu bytes\n", size);
+            ++g_failures;
+        }
+    }
+    for (size_t size = data.size() - 8; size < data.size(); ++size) load(data, size);
+
+    // corrupt the pattern row we wrote
+    uint8_t const row[] = { gt::FIRSTNOTE + 12, 1, gt::CMD_SETAD, 0xa7 };
+    size_t pos = std::search(data.begin(), data.end(), row, row + 4) - data.begin();
+    check(pos < data.size(), "pattern row found");
+    if (pos < data.size()) {
+        struct { int offset; uint8_t value; char const* what; } const CASES[] = {
+            { 0, 0x10, "note below FIRSTNOTE" },
+            { 0, 0xc0, "note above KEYON" },
+            { 1, 200,  "instrument out of range" },
+            { 1, gt::MAX_INSTR, "instrument one past the end" },
+            { 2, 0x20, "command out of range" },
+        };
+        for (auto const& c : CASES) {
+            std::vector<uint8_t> bad = data;
+            bad[pos + c.offset] = c.value;
+            check(load(bad, bad.size()) == 1, c.what);
+        }
+    }
+
+    printf("%d failures\n", g_failures);
+    return g_failures > 0;
+}
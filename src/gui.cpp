@@ -2,10 +2,12 @@
 #include "log.hpp"
 #include "app.hpp"
 #include "platform.hpp"
+#include "profiler.hpp"
 #include <cstdarg>
 #include <cstring>
 #include <cassert>
 #include <array>
+#include <chrono>
 
 
 namespace gui {
@@ -13,10 +15,29 @@ namespace {
 
 constexpr float HOLD_TIME = 0.333f;
 
+// quads of a window that are drawn with the same texture
+struct Layer {
+    gfx::Texture const* texture; // nullptr for the gui atlas
+    gfx::Mesh           mesh;
+};
+
 struct Window {
-    gfx::Mesh mesh;
-    ivec2     cursor_min;
-    ivec2     cursor_max;
+    std::vector<Layer> layers      = { {} };
+    size_t             layer_count = 1;
+    ivec2              cursor_min;
+    ivec2              cursor_max;
+
+    gfx::Mesh& mesh() { return layers[layer_count - 1].mesh; }
+    void       texture(gfx::Texture const* texture) {
+        Layer& l = layers[layer_count - 1];
+        if (l.texture == texture) return;
+        if (l.mesh.vertices.empty()) {
+            l.texture = texture;
+            return;
+        }
+        if (layers.size() == layer_count) layers.emplace_back();
+        layers[layer_count++].texture = texture;
+    }
 };
 
 std::vector<Window> g_windows = { {} };
@@ -43,7 +64,8 @@ ButtonStyle  g_button_style;
 DragBarStyle g_drag_bar_style;
 
 
-float        g_frame_time = 1.0f / 60.0f;
+float        g_refresh_time = 1.0f / 60.0f;
+float        g_frame_time   = 1.0f / 60.0f;
 float        g_hold_time;
 bool         g_hold;
 ivec2        g_touch_pos;
@@ -59,6 +81,10 @@ float        g_input_cursor_blink;
 bool         g_disabled;
 ivec2        g_drag_start;
 
+using Clock = std::chrono::steady_clock;
+Clock::time_point g_frame_start;
+FrameStats        g_frame_stats;
+
 
 
 std::array<char, 256> g_text_buffer;
@@ -209,6 +235,18 @@ namespace touch {
 
 
 
+gfx::Texture const& atlas() { return g_img; }
+
+void texture_rect(gfx::Texture const& texture, Box const& box, ivec2 uv) {
+    Window& w = g_windows[g_window_index];
+    w.texture(&texture);
+    g_dc.mesh(w.mesh());
+    g_dc.rect(box.pos, box.size, uv);
+    w.texture(nullptr);
+    g_dc.mesh(w.mesh());
+}
+
+
 void init() {
     g_img.init("gui.png");
     g_dc.font(0);
@@ -219,18 +257,27 @@ void free() {
 }
 
 void set_refresh_rate(float refresh_rate) {
-    g_frame_time = 1.0f / refresh_rate;
+    g_refresh_time = 1.0f / refresh_rate;
+    g_frame_time   = g_refresh_time;
 }
 
 float frame_time() { return g_frame_time; }
 
+FrameStats const& frame_stats() { return g_frame_stats; }
+
 size_t max_window_index() { return g_max_window_index; }
 
 void begin_frame() {
+    // frames are paced by app::frame_timeout(), so measure the time between them.
+    // the first frame after an idle period counts as a single refresh.
+    Clock::time_point now = Clock::now();
+    g_frame_time = std::chrono::duration<float>(now - g_frame_start).count();
+    if (g_frame_time > 0.1f) g_frame_time = g_refresh_time;
+    g_frame_start = now;
 
     g_window_index = 0;
     g_max_window_index = 0;
-    g_dc.mesh(g_windows[0].mesh);
+    g_dc.mesh(g_windows[0].mesh());
 
     g_cursor_min = {};
     g_cursor_max = {};
@@ -249,22 +296,62 @@ void begin_frame() {
 }
 
 void end_frame() {
+    PROFILE_SCOPE("gui::end_frame");
     assert(g_window_index == 0);
     int n = std::min(g_last_max_window_count, g_max_window_index);
+    if (n > 0) {
+        // darken everything below the top window
+        Window& w = g_windows[n - 1];
+        w.texture(nullptr);
+        g_dc.mesh(w.mesh());
+        g_dc.rgb(0);
+        g_dc.alpha(180);
+        g_dc.fill({ {}, { app::CANVAS_WIDTH, app::canvas_height() } });
+        g_dc.alpha(255);
+    }
+
+    // draw all layers in order, merging consecutive layers with the same texture
+    static std::vector<gfx::Mesh const*> meshes;
+    gfx::Texture const* texture = nullptr;
+    auto flush = [&] {
+        if (meshes.empty()) return;
+        gfx::draw(meshes.data(), meshes.size(), texture ? *texture : g_img);
+        meshes.clear();
+    };
+    g_frame_stats.vertex_count = 0;
     for (int i = 0; i <= n; ++i) {
         Window& w = g_windows[i];
-
-        if (i == n - 1) {
-            g_dc.mesh(w.mesh);
-            g_dc.rgb(0);
-            g_dc.alpha(180);
-            g_dc.fill({ {}, { app::CANVAS_WIDTH, app::canvas_height() } });
-            g_dc.alpha(255);
+        for (size_t j = 0; j < w.layer_count; ++j) {
+            Layer const& l = w.layers[j];
+            if (l.texture != texture) flush();
+            texture = l.texture;
+            meshes.push_back(&l.mesh);
+            g_frame_stats.vertex_count += l.mesh.vertices.size();
+        }
+    }
+    g_frame_stats.mesh_bytes = g_frame_stats.vertex_count * sizeof(gfx::Vertex);
+    g_frame_stats.build_time = std::chrono::duration<float, std::milli>(Clock::now() - g_frame_start).count();
+#ifdef GUI_STATS
+    // benchmark of the gui mesh, averaged over a number of frames
+    {
+        static size_t frames, bytes;
+        static float  time;
+        bytes += g_frame_stats.mesh_bytes;
+        time  += g_frame_stats.build_time;
+        if (++frames == 256) {
+            LOGD("gui: %zu mesh bytes, %.3f ms build time per frame", bytes / frames, time / frames);
+            frames = bytes = 0;
+            time   = 0;
         }
+    }
+#endif
 
-        gfx::draw(w.mesh, g_img);
-        w.mesh.vertices.clear();
-        w.mesh.indices.clear();
+    flush();
+    for (int i = 0; i <= n; ++i) {
+        Window& w = g_windows[i];
+        for (size_t j = 0; j < w.layer_count; ++j) w.layers[j].mesh.clear();
+        w.layers[0].texture = nullptr;
+        w.layer_count       = 1;
     }
     g_last_max_window_count = g_max_window_index;
 
@@ -281,7 +368,7 @@ void begin_window() {
             g_windows.emplace_back();
         }
     }
-    g_dc.mesh(g_windows[g_window_index].mesh);
+    g_dc.mesh(g_windows[g_window_index].mesh());
 }
 Box begin_window(ivec2 size) {
     begin_window();
@@ -293,7 +380,7 @@ Box begin_window(ivec2 size) {
 }
 void end_window() {
     --g_window_index;
-    g_dc.mesh(g_windows[g_window_index].mesh);
+    g_dc.mesh(g_windows[g_window_index].mesh());
     g_cursor_min = g_windows[g_window_index].cursor_min;
     g_cursor_max = g_windows[g_window_index].cursor_max;
 }
@@ -630,42 +717,25 @@ void DrawContext::box(Box const& box, BoxStyle style) {
         std::min(8, box.size.x / 2),
         std::min(8, box.size.y / 2),
     };
-    i16vec2 p0 = box.pos;
-    i16vec2 p1 = box.pos + c;
-    i16vec2 p2 = box.pos + box.size - c;
-    i16vec2 p3 = box.pos + box.size;
-    i16vec2 t0(int(style) % 16 * 16, int(style) / 16 * 16);
-    i16vec2 t1 = t0 + c;
-    i16vec2 t2 = t0 + 16 - c;
-    i16vec2 t3 = t0 + 16;
-
-    auto i0  = add_vertex({ p0.x, p0.y }, { t0.x, t0.y });
-    auto i1  = add_vertex({ p1.x, p0.y }, { t1.x, t0.y });
-    auto i2  = add_vertex({ p2.x, p0.y }, { t2.x, t0.y });
-    auto i3  = add_vertex({ p3.x, p0.y }, { t3.x, t0.y });
-    auto i4  = add_vertex({ p0.x, p1.y }, { t0.x, t1.y });
-    auto i5  = add_vertex({ p1.x, p1.y }, { t1.x, t1.y });
-    auto i6  = add_vertex({ p2.x, p1.y }, { t2.x, t1.y });
-    auto i7  = add_vertex({ p3.x, p1.y }, { t3.x, t1.y });
-    auto i8  = add_vertex({ p0.x, p2.y }, { t0.x, t2.y });
-    auto i9  = add_vertex({ p1.x, p2.y }, { t1.x, t2.y });
-    auto i10 = add_vertex({ p2.x, p2.y }, { t2.x, t2.y });
-    auto i11 = add_vertex({ p3.x, p2.y }, { t3.x, t2.y });
-    auto i12 = add_vertex({ p0.x, p3.y }, { t0.x, t3.y });
-    auto i13 = add_vertex({ p1.x, p3.y }, { t1.x, t3.y });
-    auto i14 = add_vertex({ p2.x, p3.y }, { t2.x, t3.y });
-    auto i15 = add_vertex({ p3.x, p3.y }, { t3.x, t3.y });
-    m_mesh->indices.insert(m_mesh->indices.end(), {
-        i0,  i1,  i5,  i0,  i5,  i4,
-        i1,  i2,  i6,  i1,  i6,  i5,
-        i2,  i3,  i7,  i2,  i7,  i6,
-        i4,  i5,  i9,  i4,  i9,  i8,
-        i5,  i6,  i10, i5,  i10, i9,
-        i6,  i7,  i11, i6,  i11, i10,
-        i8,  i9,  i13, i8,  i13, i12,
-        i9,  i10, i14, i9,  i14, i13,
-        i10, i11, i15, i10, i15, i14,
-    });
+    ivec2 t(int(style) % 16 * 16, int(style) / 16 * 16);
+    // 9-slice: corners keep their size, edges and center stretch.
+    // collapsed slices are degenerate and draw nothing
+    int const px[] = { box.pos.x, box.pos.x + c.x, box.pos.x + box.size.x - c.x, box.pos.x + box.size.x };
+    int const py[] = { box.pos.y, box.pos.y + c.y, box.pos.y + box.size.y - c.y, box.pos.y + box.size.y };
+    int const tx[] = { t.x, t.x + c.x, t.x + 16 - c.x, t.x + 16 };
+    int const ty[] = { t.y, t.y + c.y, t.y + 16 - c.y, t.y + 16 };
+
+    std::vector<gfx::Vertex>& v = m_mesh->vertices;
+    std::vector<gfx::Mesh::BoxRun>& runs = m_mesh->box_runs;
+    uint32_t n = v.size();
+    if (runs.empty() || runs.back().first + runs.back().count != n) runs.push_back({ n, 0 });
+    runs.back().count += 16;
+    v.resize(n + 16);
+    for (int y = 0; y < 4; ++y) {
+        for (int x = 0; x < 4; ++x) {
+            v[n + y * 4 + x] = { ivec2(px[x], py[y]), ivec2(tx[x], ty[y]), m_color };
+        }
+    }
 }
 
 
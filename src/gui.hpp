@@ -155,24 +155,15 @@ class DrawContext {
 public:
 
     void fill(Box const& box) {
-        i16vec2 uv(1, 1); // a white pixel
-        auto i0 = add_vertex(box.pos, uv);
-        auto i1 = add_vertex(box.pos + box.size.xo(), uv);
-        auto i2 = add_vertex(box.pos + box.size, uv);
-        auto i3 = add_vertex(box.pos + box.size.oy(), uv);
-        m_mesh->indices.insert(m_mesh->indices.end(), { i0, i1, i2, i0, i2, i3 });
+        quad(box.pos, box.size, { 1, 1 }, {}); // a white pixel
     }
 
     void rect(ivec2 pos, ivec2 size, ivec2 uv) {
-        uint16_t i0 = add_vertex(pos, uv);
-        uint16_t i1 = add_vertex(pos + ivec2(size.x, 0), uv + ivec2(size.x, 0));
-        uint16_t i2 = add_vertex(pos + size, uv + size);
-        uint16_t i3 = add_vertex(pos + ivec2(0, size.y), uv + ivec2(0, size.y));
-        m_mesh->indices.insert(m_mesh->indices.end(), { i0, i1, i2, i0, i2, i3 });
+        quad(pos, size, uv, size);
     }
 
     void character(ivec2 pos, uint8_t g) {
-        if (g >= 128) return;
+        if (g >= 128 || g == ' ') return; // the space glyph is blank
         int o = g < 32 ? 0 : m_font_offset;
         ivec2 uv(g % 32 * m_char_size.x, g / 32 * m_char_size.x + o);
         rect(pos, m_char_size, uv);
@@ -214,6 +205,16 @@ public:
         }
     }
 
+    // fast paths for dense views: no formatting, no control bytes
+    void glyphs(ivec2 pos, char const* glyphs, int count) {
+        for (int i = 0; i < count; ++i, pos.x += m_char_size.x) character(pos, glyphs[i]);
+    }
+    void hex(ivec2 pos, int value, int digits) {
+        for (int i = digits - 1; i >= 0; --i, pos.x += m_char_size.x) {
+            character(pos, "0123456789ABCDEF"[(value >> i * 4) & 0xf]);
+        }
+    }
+
     void box(Box const& box, BoxStyle style = BoxStyle::Normal);
 
     void mesh(gfx::Mesh& mesh) {
@@ -232,10 +233,14 @@ public:
     }
 
 private:
-    uint16_t add_vertex(i16vec2 pos, i16vec2 uv) {
-        uint16_t index = m_mesh->vertices.size();
-        m_mesh->vertices.push_back({ pos, uv, m_color });
-        return index;
+    void quad(ivec2 pos, ivec2 size, ivec2 uv, ivec2 uv_size) {
+        std::vector<gfx::Vertex>& v = m_mesh->vertices;
+        size_t n = v.size();
+        v.resize(n + 4);
+        v[n + 0] = { pos, uv, m_color };
+        v[n + 1] = { pos + size.xo(), uv + uv_size.xo(), m_color };
+        v[n + 2] = { pos + size, uv + uv_size, m_color };
+        v[n + 3] = { pos + size.oy(), uv + uv_size.oy(), m_color };
     }
 
     u8vec4     m_color       = { 255 };
@@ -325,9 +330,16 @@ void   free();
 void   touch_event(int x, int y, bool pressed);
 void   key_event(int key, int unicode);
 void   set_refresh_rate(float refresh_rate);
-float  frame_time();
+float  frame_time(); // seconds since the previous frame
 size_t max_window_index();
 
+struct FrameStats {
+    size_t vertex_count;
+    size_t mesh_bytes;
+    float  build_time; // milliseconds from begin_frame to end_frame
+};
+FrameStats const& frame_stats();
+
 
 namespace touch {
     ivec2 pos();
@@ -404,9 +416,12 @@ bool choose(int width, char const* desc, T& value, std::initializer_list<char co
 
 // low level functions
 enum class ButtonState { Normal, Pressed, Released };
-DrawContext& draw_context();
-Box          item_box();
-ButtonState  button_state(Box const& box, void const* addr = nullptr);
-ivec2        text_pos(Box const& box, char const* text);
+DrawContext&        draw_context();
+Box                 item_box();
+ButtonState         button_state(Box const& box, void const* addr = nullptr);
+ivec2               text_pos(Box const& box, char const* text);
+gfx::Texture const& atlas();
+// draw a region of another texture, e.g. a render cache, in the current color
+void                texture_rect(gfx::Texture const& texture, Box const& box, ivec2 uv);
 
 } // namespace
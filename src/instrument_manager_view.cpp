@@ -1,14 +1,16 @@
 #include "instrument_manager_view.hpp"
 #include "instrument_view.hpp"
 #include "app.hpp"
+#include "jobs.hpp"
 #include "platform.hpp"
 #include "piano.hpp"
 #include "sha256.hpp"
+#include "mapped_file.hpp"
 #include <algorithm>
 #include <cstdio>
 #include <filesystem>
 #include <cstring>
-#include <fstream>
+#include <memory>
 #include <sstream>
 #include <vector>
 
@@ -29,12 +31,14 @@ std::vector<std::string> g_preset_names;
 std::vector<std::string> g_user_names;
 int                      g_file_scroll;
 int                      g_preset_scroll;
+jobs::Handle             g_scan_job;
+bool                     g_scan_stale; // the directory changed while the scan was running
 
 
 #define FILE_SUFFIX ".ins"
 
 
-void remove_legacy_instruments() {
+void remove_legacy_instruments(std::string const& dir) {
     struct LegacyInstrument {
         char const* name;
         char const* sha256;
@@ -53,26 +57,42 @@ void remove_legacy_instruments() {
     };
 
     for (LegacyInstrument const& legacy : LEGACY_INSTRUMENTS) {
-        fs::path path = g_instruments_dir + legacy.name + FILE_SUFFIX;
-        if (!fs::is_regular_file(path)) continue;
-        std::ifstream stream(path, std::ios::binary);
-        if (!stream.is_open()) continue;
-        std::vector<uint8_t> data((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
-        if (!sha256::sha256_matches_hex(data.data(), data.size(), legacy.sha256)) continue;
-        fs::remove(path);
+        fs::path path = dir + legacy.name + FILE_SUFFIX;
+        MappedFile file;
+        if (!file.open(path.string().c_str())) continue;
+        bool matches = sha256::sha256_matches_hex(file.data(), file.size(), legacy.sha256);
+        file.close();
+        if (matches) fs::remove(path);
     }
 }
 
-template <class T>
-bool read(std::istream& stream, T& v) {
-    stream.read((char*) &v, sizeof(T));
-    return stream.good();
-}
-
-uint8_t read8(std::istream& stream) {
-    uint8_t b;
-    read(stream, b);
-    return b;
+// List the user instruments in the background, first removing the legacy ones
+// if asked to. A scan that raced with changes to the directory is repeated
+// instead of applied.
+void scan_user_names(bool remove_legacy = false) {
+    if (g_scan_job) {
+        g_scan_stale = true;
+        return;
+    }
+    g_scan_stale = false;
+    auto names = std::make_shared<std::vector<std::string>>();
+    g_scan_job = jobs::start(jobs::Priority::Low, [dir = g_instruments_dir, names, remove_legacy](jobs::Token& token) {
+        if (remove_legacy) remove_legacy_instruments(dir);
+        std::error_code ec;
+        for (auto const& entry : fs::directory_iterator(dir, ec)) {
+            if (token.canceled) return;
+            if (!entry.is_regular_file(ec)) continue;
+            if (entry.path().extension().string() != FILE_SUFFIX) continue;
+            names->emplace_back(entry.path().stem().string());
+        }
+        std::sort(names->begin(), names->end(), [](std::string const& a, std::string const& b) {
+            return strcasecmp(a.c_str(), b.c_str()) < 0;
+        });
+    }, [names](jobs::Token&) {
+        g_scan_job = nullptr;
+        if (g_scan_stale) scan_user_names();
+        else g_user_names = std::move(*names);
+    });
 }
 
 template <class T>
@@ -81,66 +101,60 @@ bool write(std::ostream& stream, T const& v) {
     return stream.good();
 }
 
-bool load_instrument(std::istream& stream) {
-    std::array<char, 4> ident;
-    read(stream, ident);
-    if (ident != std::array<char, 4>{'G', 'T', 'I', '5'}) {
-        app::alert("LOAD ERROR", "Bad file format");
-        return false;
-    }
+bool load_instrument(uint8_t const* data, size_t size) {
     instrument_view::InstrumentCopyBuffer b = {};
-    b.instr_num = 0;
-    b.instr.ad = read8(stream);
-    b.instr.sr = read8(stream);
-    read(stream, b.instr.ptr);
-    b.instr.vibdelay = read8(stream);
-    b.instr.gatetimer = read8(stream);
-    b.instr.firstwave = read8(stream);
-    read(stream, b.instr.name);
-    for (int t = 0; t < gt::MAX_TABLES; ++t) {
-        int len = read8(stream);
-        if (len == 0) {
-            assert(b.instr.ptr[t] == 0);
-            continue;
-        }
-        assert(b.instr.ptr[t] > 0);
-        int s = b.instr.ptr[t] - 1;
-        for (int i = 0; i < len; ++i) {
-            b.ltable[t][s + i] = read8(stream);
-        }
-        for (int i = 0; i < len; ++i) {
-            b.rtable[t][s + i] = read8(stream);
+    try {
+        gt::Reader reader(data, size);
+        if (memcmp(reader.bytes(4), "GTI5", 4) != 0) throw gt::LoadError("Bad file format");
+        b.instr_num = 0;
+        b.instr.ad = reader.u8();
+        b.instr.sr = reader.u8();
+        reader.read(b.instr.ptr);
+        b.instr.vibdelay = reader.u8();
+        b.instr.gatetimer = reader.u8();
+        b.instr.firstwave = reader.u8();
+        reader.read(b.instr.name);
+        for (int t = 0; t < gt::MAX_TABLES; ++t) {
+            int len = reader.u8();
+            if (len == 0) {
+                if (b.instr.ptr[t] != 0) throw gt::LoadError("Bad table pointer");
+                continue;
+            }
+            int s = b.instr.ptr[t] - 1;
+            if (s < 0 || s + len > gt::MAX_TABLELEN) throw gt::LoadError("Bad table pointer");
+            memcpy(b.ltable[t].data() + s, reader.bytes(len), len);
+            memcpy(b.rtable[t].data() + s, reader.bytes(len), len);
         }
     }
+    catch (gt::LoadError const& e) {
+        app::alert("LOAD ERROR", e.msg);
+        return false;
+    }
     b.paste();
     return true;
 }
 
 void load_preset() {
-    std::vector<uint8_t> buffer;
-    if (!platform::load_asset("instruments/" + std::string(g_file_name.data()) + FILE_SUFFIX, buffer)) {
+    platform::Asset asset;
+    if (!platform::load_asset("instruments/" + std::string(g_file_name.data()) + FILE_SUFFIX, asset)) {
         app::alert("LOAD ERROR", "Cannot open file");
         return;
     }
-    std::istringstream stream(std::string(buffer.begin(), buffer.end()), std::ios::binary);
-    load_instrument(stream);
+    load_instrument(asset.data, asset.size);
 }
 
 void load_user() {
-    std::ifstream stream(g_instruments_dir + g_file_name.data() + FILE_SUFFIX, std::ios::binary);
-    if (!stream.is_open()) {
+    MappedFile file;
+    if (!file.open((g_instruments_dir + g_file_name.data() + FILE_SUFFIX).c_str())) {
         app::alert("LOAD ERROR", "Cannot open file");
         return;
     }
-    load_instrument(stream);
+    load_instrument(file.data(), file.size());
 }
 
+// serialize right away, but leave the writing to a job
 void save_instrument() {
-    std::ofstream stream(g_instruments_dir + g_file_name.data() + FILE_SUFFIX, std::ios::binary);
-    if (!stream.is_open()) {
-        app::alert("SAVE ERROR");
-        return;
-    }
+    std::ostringstream stream;
     stream.write("GTI5", 4);
     gt::Instrument const& instr = g_song.instruments[piano::instrument()];
     write(stream, instr.ad);
@@ -178,7 +192,14 @@ void save_instrument() {
             write<uint8_t>(stream, g_song.rtable[t][start + i]);
         }
     }
-    init();
+    std::string path = g_instruments_dir + g_file_name.data() + FILE_SUFFIX;
+    auto ok = std::make_shared<bool>(false);
+    jobs::start(jobs::Priority::High, [path, data = stream.str(), ok](jobs::Token&) {
+        *ok = write_file_atomic(path.c_str(), data.data(), data.size());
+    }, [ok](jobs::Token&) {
+        if (!*ok) app::alert("SAVE ERROR");
+        scan_user_names();
+    });
 }
 
 } // namespace
@@ -192,14 +213,16 @@ void reset() {
     g_user_names      = {};
     g_file_scroll     = {};
     g_preset_scroll   = {};
+    g_scan_job        = {};
+    g_scan_stale      = {};
 }
 
 
 void init() {
-    if (g_instruments_dir.empty()) {
+    bool first = g_instruments_dir.empty();
+    if (first) {
         g_instruments_dir = app::storage_dir() + "/instruments/";
         fs::create_directories(g_instruments_dir);
-        remove_legacy_instruments();
     }
 
     g_preset_names.clear();
@@ -212,15 +235,7 @@ void init() {
         return strcasecmp(a.c_str(), b.c_str()) < 0;
     });
 
-    g_user_names.clear();
-    for (auto const& entry : fs::directory_iterator(g_instruments_dir)) {
-        if (!entry.is_regular_file()) continue;
-        if (entry.path().extension().string() != FILE_SUFFIX) continue;
-        g_user_names.emplace_back(entry.path().stem().string());
-    }
-    std::sort(g_user_names.begin(), g_user_names.end(), [](std::string const& a, std::string const& b) {
-        return strcasecmp(a.c_str(), b.c_str()) < 0;
-    });
+    scan_user_names(first);
 }
 
 
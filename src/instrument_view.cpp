@@ -4,6 +4,9 @@
 #include "command_edit.hpp"
 #include "log.hpp"
 #include "piano.hpp"
+#include "song_index.hpp"
+#include "song_view.hpp"
+#include "table_space.hpp"
 
 #include <cassert>
 
@@ -30,63 +33,10 @@ int                  g_cursor_row;
 std::array<int, 4>   g_table_scroll;
 bool                 g_table_debug;
 bool                 g_draw_share_window;
+bool                 g_draw_usage_window;
 InstrumentCopyBuffer g_instr_copy_buffer;
 
 
-void add_table_row(int table, int pos) {
-    // shift instr pointer
-    for (gt::Instrument& instr : g_song.instruments) {
-        if (instr.ptr[table] > pos + 1) {
-            ++instr.ptr[table];
-        }
-    }
-
-    // shift table jump pointers
-    auto& ltable = g_song.ltable[table];
-    auto& rtable = g_song.rtable[table];
-    for (int i = pos + 1; i < gt::MAX_TABLELEN; ++i) {
-        if (ltable[i] == 0xff && rtable[i] >= pos + 1) {
-            ++rtable[i];
-        }
-    }
-    // new row
-    std::rotate(ltable.begin() + pos, ltable.end() - 1, ltable.end());
-    std::rotate(rtable.begin() + pos, rtable.end() - 1, rtable.end());
-}
-
-
-void delete_table_row(int table, int pos) {
-    auto& ltable = g_song.ltable[table];
-    auto& rtable = g_song.rtable[table];
-
-    // check if we're deleting the jump row
-    // in that case, we want to also clear pointers in instruments
-    bool is_jump_row = ltable[pos] == 0xff;
-
-    // shift instr pointer
-    for (gt::Instrument& instr : g_song.instruments) {
-        if (is_jump_row && instr.ptr[table] == pos + 1) {
-            instr.ptr[table] = 0; // reset pointer
-        }
-        else if (instr.ptr[table] > pos + 1) {
-            --instr.ptr[table];
-        }
-    }
-
-    // shift table jump pointers
-    for (int i = pos + 1; i < gt::MAX_TABLELEN; ++i) {
-        if (ltable[i] == 0xff && rtable[i] > pos + 1) {
-            --rtable[i];
-        }
-    }
-    // delete row
-    ltable[pos] = 0;
-    rtable[pos] = 0;
-    std::rotate(ltable.begin() + pos, ltable.begin() + pos + 1, ltable.end());
-    std::rotate(rtable.begin() + pos, rtable.begin() + pos + 1, rtable.end());
-}
-
-
 void draw_table_debug() {
     enum class CursorSelect {
         WaveTable,
@@ -142,7 +92,8 @@ void draw_table_debug() {
 
             num_box.pos.x += 1;
             num_box.size.x -= 2;
-            dc.rgb(color::ROW_NUMBER);
+            // rows of no instrument's table part are free
+            dc.rgb(song_index::table_row_owner(t, row) ? color::ROW_NUMBER : color::DARK_GREY);
             if (row == pos) {
                 dc.rgb(color::BUTTON_ACTIVE);
                 dc.fill(num_box);
@@ -333,33 +284,11 @@ void InstrumentCopyBuffer::paste() const {
         auto&       dst_ltable = g_song.ltable[t];
         auto&       dst_rtable = g_song.rtable[t];
 
-        // check if current table is shared
-        int share_count = 0;
-        if (dst.ptr[t] > 0) {
-            for (size_t i = 0; i < gt::MAX_INSTR; ++i) {
-                gt::Instrument const& in = g_song.instruments[i];
-                if (in.ptr[t] == dst.ptr[t]) {
-                    ++share_count;
-                }
-            }
-        }
-
-        // delete table if not shared
-        if (share_count == 1) {
-            int start = dst.ptr[t] - 1;
-            for (;;) {
-                uint8_t v = dst_ltable[start];
-                delete_table_row(t, start);
-                if (v == 0xff) break;
-            }
-        }
+        // free current table unless it's shared
+        table_space::release(t, piano::instrument());
 
         // check if there's a new table
-        if (instr.ptr[t] == 0) {
-            dst.ptr[t] = 0;
-            continue;
-        }
-
+        if (instr.ptr[t] == 0) continue;
 
         // check if we can borrow new table
         if (instr_num > 0 && instr_num != piano::instrument()) {
@@ -388,19 +317,19 @@ void InstrumentCopyBuffer::paste() const {
             }
         }
 
-
-
-
-        // check if there's enough space
+        // find space for the table
         int start_row = instr.ptr[t] - 1;
         int end_row   = start_row;
         for (; end_row < gt::MAX_TABLELEN; ++end_row) {
             if (src_ltable[end_row] == 0xff) break;
         }
-        int new_start_row = g_song.get_table_length(t);
-        if (end_row - start_row > gt::MAX_TABLELEN - new_start_row) {
+        if (end_row == gt::MAX_TABLELEN) {
+            LOGW("InstrumentCopyBuffer::paste: table %d has no jump row", t);
+            continue;
+        }
+        int new_start_row = table_space::alloc(t, end_row - start_row + 1);
+        if (new_start_row < 0) {
             LOGW("InstrumentCopyBuffer::paste: not enough space in table %d", t);
-            dst.ptr[t] = 0;
             continue;
         }
 
@@ -452,7 +381,8 @@ void draw() {
     gt::Instrument& instr = g_song.instruments[instr_nr];
 
     gui::item_size({ 12 + 8*2, app::BUTTON_HEIGHT });
-    gui::text("%02X", instr_nr);
+    sprintf(str, "%02X", instr_nr);
+    if (gui::button(str, g_draw_usage_window)) g_draw_usage_window ^= 1;
     gui::same_line();
 
     gui::item_size({ app::CANVAS_WIDTH - app::BUTTON_HEIGHT * 4 - gui::cursor().x, app::BUTTON_HEIGHT });
@@ -547,15 +477,8 @@ void draw() {
     gui::button_style(gui::ButtonStyle::Normal);
 
     // instr sharing
-    size_t      share_count       = 0;
-    if (instr.ptr[g_table] > 0) {
-        for (size_t i = 0; i < gt::MAX_INSTR; ++i) {
-            gt::Instrument const& in = g_song.instruments[i];
-            if (in.ptr[g_table] == instr.ptr[g_table]) {
-                ++share_count;
-            }
-        }
-    }
+    int share_count = 0;
+    if (instr.ptr[g_table] > 0) share_count = song_index::table_part_users(g_table, instr.ptr[g_table] - 1);
     gui::item_size({ app::BUTTON_HEIGHT * 2, app::BUTTON_HEIGHT });
     if (gui::button(gui::Icon::Share, share_count >= 2)) {
         g_draw_share_window = true;
@@ -735,19 +658,19 @@ void draw() {
 
 
     // buttons
-    int num_free_rows = gt::MAX_TABLELEN - g_song.get_table_length(g_table);
+    int num_free_rows = table_space::free_rows(g_table);
     if (g_cursor_select == CursorSelect::Table) {
         gui::cursor({ app::CANVAS_WIDTH - 55, cursor.y });
         gui::item_size({ 55, app::BUTTON_HEIGHT });
 
         gui::disabled(g_cursor_row >= len);
         if (gui::button(gui::Icon::DeleteRow)) {
-            delete_table_row(g_table, start_row + g_cursor_row);
+            table_space::delete_row(g_table, start_row + g_cursor_row);
             --len;
             --end_row;
             if (len == 0) {
                 // delete jump row
-                delete_table_row(g_table, start_row);
+                table_space::delete_row(g_table, start_row);
             }
             else {
                 // clamp jump pointer
@@ -761,20 +684,19 @@ void draw() {
             uint8_t cursor_lval = ltable[start_row + g_cursor_row];
             uint8_t cursor_rval = rtable[start_row + g_cursor_row];
             ++len;
-            add_table_row(g_table, start_row + g_cursor_row);
-            ltable[start_row + g_cursor_row] = cursor_lval;
-            rtable[start_row + g_cursor_row] = cursor_rval;
+            int row = table_space::insert_row(g_table, start_row + g_cursor_row);
+            ltable[row] = cursor_lval;
+            rtable[row] = cursor_rval;
         }
-        gui::disabled(num_free_rows == 0 && len != 0);
+        gui::disabled(num_free_rows < (len == 0 ? 2 : 1));
         if (gui::button(gui::Icon::AddRowBelow)) {
             uint8_t cursor_lval = 0;
             uint8_t cursor_rval = 0;
             // add jump
             if (len == 0) {
-                assert(num_free_rows >= 2);
-                start_row = gt::MAX_TABLELEN - num_free_rows;
+                start_row = table_space::alloc(g_table, 2);
+                assert(start_row >= 0);
                 instr.ptr[g_table] = start_row + 1;
-                add_table_row(g_table, start_row);
                 ltable[start_row] = 0xff;
                 rtable[start_row] = 0x00;
                 ++len;
@@ -791,9 +713,9 @@ void draw() {
                 ++g_cursor_row;
             }
             ++len;
-            add_table_row(g_table, start_row + g_cursor_row);
-            ltable[start_row + g_cursor_row] = cursor_lval;
-            rtable[start_row + g_cursor_row] = cursor_rval;
+            int row = table_space::insert_row(g_table, start_row + g_cursor_row);
+            ltable[row] = cursor_lval;
+            rtable[row] = cursor_rval;
         }
         gui::disabled(len == 0);
         if (gui::button(gui::Icon::JumpBack)) {
@@ -1099,10 +1021,10 @@ void draw() {
             [&](int i) {
                 g_draw_share_window = false;
                 gt::Instrument const& in = g_song.instruments[i];
-                if (instr.ptr[g_table] != in.ptr[g_table] && share_count == 1) {
+                if (instr.ptr[g_table] != in.ptr[g_table]) {
                     // TODO: confirmation dialog
-                    // delete table
-                    for (int i = 0; i <= len; ++i) delete_table_row(g_table, start_row);
+                    // delete table unless it's shared
+                    table_space::release(g_table, instr_nr);
                 }
                 instr.ptr[g_table] = in.ptr[g_table];
             },
@@ -1112,7 +1034,11 @@ void draw() {
                 if (gui::button("CLONE")) {
                     g_draw_share_window = false;
                     // copy
-                    int new_start_row = ltable.size() - num_free_rows;
+                    int new_start_row = table_space::alloc(g_table, len + 1);
+                    assert(new_start_row >= 0);
+                    // allocating may have moved the table
+                    start_row = instr.ptr[g_table] - 1;
+                    end_row   = start_row + len;
                     for (int i = 0; i <= len; ++i) {
                         ltable[new_start_row + i] = ltable[start_row + i];
                         rtable[new_start_row + i] = rtable[start_row + i];
@@ -1128,11 +1054,8 @@ void draw() {
                 gui::disabled(instr.ptr[g_table] == 0);
                 if (gui::button("DELETE")) {
                     g_draw_share_window = false;
-                    if (share_count == 1) {
-                        // delete table
-                        for (int i = 0; i <= len; ++i) delete_table_row(g_table, start_row);
-                    }
-                    instr.ptr[g_table] = 0;
+                    // delete table unless it's shared
+                    table_space::release(g_table, instr_nr);
                 }
                 gui::disabled(false);
                 gui::same_line();
@@ -1141,6 +1064,39 @@ void draw() {
     }
 
 
+    // instrument usage window
+    if (g_draw_usage_window) {
+        enum { COLS = 8, MAX_ROWS = 8 };
+        std::array<int, gt::MAX_PATT> patts;
+        int count = 0;
+        for (int p = 0; p < gt::MAX_PATT; ++p) {
+            if (song_index::instrument_refs(instr_nr, p) > 0) patts[count++] = p;
+        }
+        count    = std::min<int>(count, COLS * MAX_ROWS);
+        int rows = (count + COLS - 1) / COLS;
+        gui::Box box = gui::begin_window({ app::CANVAS_WIDTH - 12, app::BUTTON_HEIGHT * (rows + 2) + gui::FRAME_WIDTH * 2 });
+        gui::item_size({ box.size.x, app::BUTTON_HEIGHT });
+        gui::text("INSTRUMENT %02X, %d PATTERN ROWS", instr_nr, song_index::instrument_refs(instr_nr));
+        gui::separator();
+        // patterns that use the instrument, shaded if no order row plays them
+        gui::item_size({ box.size.x / COLS, app::BUTTON_HEIGHT });
+        for (int i = 0; i < count; ++i) {
+            int p = patts[i];
+            gui::same_line(i % COLS > 0);
+            gui::button_style(song_index::pattern_refs(p) ? gui::ButtonStyle::Normal : gui::ButtonStyle::Shaded);
+            sprintf(str, "%02X", p);
+            if (gui::button(str) && song_view::show_pattern(p)) {
+                g_draw_usage_window = false;
+                app::go_to_song_view();
+            }
+        }
+        gui::button_style(gui::ButtonStyle::Normal);
+        gui::item_size({ box.size.x, app::BUTTON_HEIGHT });
+        gui::separator();
+        if (gui::button("CLOSE")) g_draw_usage_window = false;
+        gui::end_window();
+    }
+
     command_edit::draw();
 
     piano::draw();
@@ -0,0 +1,181 @@
+#include "jobs.hpp"
+
+#include "app.hpp"
+
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace jobs {
+namespace {
+
+enum {
+    // the audio and UI threads need cores too
+    MAX_WORKERS    = 3,
+    PRIORITY_COUNT = 3,
+};
+
+struct Job {
+    Handle     token;
+    Work       work;
+    Completion completion;
+};
+
+struct Worker {
+    std::mutex                                  mutex;
+    std::array<std::deque<Job>, PRIORITY_COUNT> queues;
+    Handle                                      current; // token of the running job
+    std::thread                                 thread;
+};
+
+std::vector<std::unique_ptr<Worker>> g_workers;
+std::atomic<int>                     g_next_worker{ 0 };
+std::atomic<int>                     g_unfinished{ 0 }; // started jobs whose completion hasn't run
+
+// workers sleep until a job is queued
+std::mutex              g_mutex;
+std::condition_variable g_wake;
+int                     g_queued = 0; // jobs in the queues that no worker has claimed yet
+bool                    g_quit   = false;
+
+std::mutex       g_done_mutex;
+std::vector<Job> g_done;
+
+
+void finish(Job job) {
+    job.work = {};
+    {
+        std::lock_guard<std::mutex> lock(g_done_mutex);
+        g_done.push_back(std::move(job));
+    }
+    app::request_redraw();
+}
+
+// take the most urgent job, from the front of our own queue or from the back of another
+bool take_job(int worker, Job& job) {
+    int count = g_workers.size();
+    for (int p = 0; p < PRIORITY_COUNT; ++p) {
+        for (int i = 0; i < count; ++i) {
+            Worker& w = *g_workers[(worker + i) % count];
+            std::lock_guard<std::mutex> lock(w.mutex);
+            std::deque<Job>& queue = w.queues[p];
+            if (queue.empty()) continue;
+            if (i == 0) {
+                job = std::move(queue.front());
+                queue.pop_front();
+            }
+            else {
+                job = std::move(queue.back());
+                queue.pop_back();
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void work(int worker) {
+    Worker& w = *g_workers[worker];
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(g_mutex);
+            g_wake.wait(lock, [] { return g_queued > 0 || g_quit; });
+            // queued jobs still run on quit, with their tokens canceled
+            if (g_queued == 0) return;
+            --g_queued;
+        }
+        // we claimed a job, but another worker may take the one we see first
+        Job job;
+        while (!take_job(worker, job)) std::this_thread::yield();
+        {
+            std::lock_guard<std::mutex> lock(w.mutex);
+            w.current = job.token;
+        }
+        job.work(*job.token);
+        {
+            std::lock_guard<std::mutex> lock(w.mutex);
+            w.current = nullptr;
+        }
+        finish(std::move(job));
+    }
+}
+
+} // namespace
+
+
+void init() {
+#ifndef __EMSCRIPTEN__
+    if (!g_workers.empty()) return;
+    int count = std::clamp<int>(std::thread::hardware_concurrency() / 2, 1, MAX_WORKERS);
+    g_quit = false;
+    for (int i = 0; i < count; ++i) g_workers.push_back(std::make_unique<Worker>());
+    for (int i = 0; i < count; ++i) g_workers[i]->thread = std::thread(work, i);
+#endif
+}
+
+void free() {
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        g_quit = true;
+    }
+    for (auto& w : g_workers) {
+        std::lock_guard<std::mutex> lock(w->mutex);
+        for (auto& queue : w->queues) {
+            for (Job& job : queue) job.token->canceled = true;
+        }
+        if (w->current) w->current->canceled = true;
+    }
+    g_wake.notify_all();
+    for (auto& w : g_workers) w->thread.join();
+    g_workers.clear();
+
+    // nobody is left to apply the results
+    std::lock_guard<std::mutex> lock(g_done_mutex);
+    g_done.clear();
+    g_unfinished = 0;
+}
+
+Handle start(Priority priority, Work work, Completion completion) {
+    Job job = { std::make_shared<Token>(), std::move(work), std::move(completion) };
+    Handle token = job.token;
+    ++g_unfinished;
+    if (g_workers.empty()) {
+        job.work(*job.token);
+        finish(std::move(job));
+        return token;
+    }
+    Worker& w = *g_workers[g_next_worker++ % g_workers.size()];
+    {
+        std::lock_guard<std::mutex> lock(w.mutex);
+        w.queues[int(priority)].push_back(std::move(job));
+    }
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        ++g_queued;
+    }
+    g_wake.notify_one();
+    return token;
+}
+
+void drain() {
+    std::vector<Job> done;
+    {
+        std::lock_guard<std::mutex> lock(g_done_mutex);
+        done.swap(g_done);
+    }
+    for (Job& job : done) {
+        if (job.completion) job.completion(*job.token);
+        --g_unfinished;
+    }
+}
+
+bool busy() {
+    return g_unfinished > 0;
+}
+
+} // namespace jobs
@@ -0,0 +1,32 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <memory>
+
+// Background jobs for everything that isn't real-time: saves, exports,
+// directory scans and file hashing. A few workers take jobs from their own
+// queue and steal from the others' when they run dry, higher priorities
+// first. A job's token carries its cancellation and progress as atomics.
+// When the work returns, the completion is queued for the UI thread, where
+// app::draw runs it, so results can be applied without locks. The web build
+// has no threads and runs the work right away in start.
+namespace jobs {
+
+enum class Priority { High, Normal, Low };
+
+struct Token {
+    std::atomic<bool>  canceled{ false }; // long jobs should check this and return early
+    std::atomic<float> progress{ 0.0f };  // 0 to 1, set by the job
+};
+
+using Handle     = std::shared_ptr<Token>;
+using Work       = std::function<void(Token&)>; // runs on a worker
+using Completion = std::function<void(Token&)>; // runs on the UI thread, also for canceled jobs
+
+void   init();
+void   free();  // cancels all jobs and waits for them, jobs that must not be lost simply ignore the token
+Handle start(Priority priority, Work work, Completion completion = {});
+void   drain(); // UI thread: run the completions of finished jobs
+bool   busy();  // jobs are queued or running, or their completions haven't run yet
+
+} // namespace jobs
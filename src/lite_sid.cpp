@@ -0,0 +1,408 @@
+#include "lite_sid.hpp"
+#include "resid/filter.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+namespace {
+
+enum {
+    CYCLES_PER_SAMPLE     = Sid::CLOCKRATE_PAL / Sid::MIXRATE,
+    CYCLES_PER_SAMPLE_RMD = Sid::CLOCKRATE_PAL % Sid::MIXRATE,
+};
+
+constexpr float SAMPLES_PER_CYCLE = float(Sid::MIXRATE) / Sid::CLOCKRATE_PAL;
+
+// reSID scales the 20 bit voices down to 13 bits and the mix by 1/11
+constexpr float OUTPUT_SCALE = 1.0f / (128 * 11);
+
+// 16 Hz high-pass at the output, like reSID's external filter
+constexpr float DC_POLE = 0.99762f;
+
+// voice control register bits
+enum {
+    GATE  = 0x01,
+    SYNC  = 0x02,
+    RING  = 0x04,
+    TEST  = 0x08,
+    TRI   = 0x10,
+    SAW   = 0x20,
+    PULSE = 0x40,
+    NOISE = 0x80,
+};
+
+// filter mode and volume register bits
+enum {
+    LOWPASS   = 0x10,
+    BANDPASS  = 0x20,
+    HIGHPASS  = 0x40,
+    VOICE3OFF = 0x80,
+};
+
+// cycles per envelope step for each rate, as in reSID
+constexpr int RATE_PERIODS[16] = {
+    9, 32, 63, 95, 149, 220, 267, 313, 392, 977, 1954, 3126, 3907, 11720, 19532, 31251,
+};
+
+// step period of an envelope that stays where it is
+constexpr int ENV_HELD = 1 << 30;
+
+struct Tables {
+    std::array<uint8_t, 256>  exp_periods; // envelope steps per counter step when decaying
+    std::array<float, 2048>   g_6581;      // filter coefficient for each cutoff register value
+    std::array<float, 2048>   g_8580;
+};
+
+Tables make_tables() {
+    Tables t;
+    for (int i = 0; i < 256; ++i) {
+        t.exp_periods[i] = i >= 0x5d ? 1 : i >= 0x36 ? 2 : i >= 0x1a ? 4 : i >= 0x0e ? 8 : i >= 0x06 ? 16 : 30;
+    }
+    // take the cutoff curves from reSID
+    for (int m = 0; m < 2; ++m) {
+        Filter filter;
+        filter.set_chip_model(m == 0 ? MOS6581 : MOS8580);
+        fc_point const* points;
+        int             count;
+        filter.fc_default(points, count);
+        std::array<int, 2048> f0 = {};
+        interpolate(points, points + count - 1, PointPlotter<int>(f0.data()), 1.0);
+        std::array<float, 2048>& g = m == 0 ? t.g_6581 : t.g_8580;
+        for (int fc = 0; fc < 2048; ++fc) {
+            // reSID limits the cutoff to 16kHz too
+            g[fc] = std::tan(float(M_PI) * std::min(f0[fc], 16000) / Sid::MIXRATE);
+        }
+    }
+    return t;
+}
+
+Tables const& tables() {
+    // Initialization of the local static is thread safe.
+    static Tables const t = make_tables();
+    return t;
+}
+
+// 12 bit waveform output. Combined waveforms are approximated by ANDing.
+int wave_output(int control, uint32_t acc, uint32_t pw, uint32_t noise, uint32_t ring_acc) {
+    if (!(control & 0xf0)) return 0;
+    int out = 0xfff;
+    if (control & TRI) {
+        uint32_t msb = (control & RING) ? acc ^ ring_acc : acc;
+        out &= (((msb & 0x800000) ? ~acc : acc) >> 11) & 0xfff;
+    }
+    if (control & SAW) out &= acc >> 12;
+    if (control & PULSE) out &= (control & TEST) || (acc >> 12) >= pw ? 0xfff : 0;
+    if (control & NOISE) {
+        out &= ((noise & 0x400000) >> 11) |
+               ((noise & 0x100000) >> 10) |
+               ((noise & 0x010000) >> 7) |
+               ((noise & 0x002000) >> 5) |
+               ((noise & 0x000800) >> 4) |
+               ((noise & 0x000080) >> 1) |
+               ((noise & 0x000010) << 1) |
+               ((noise & 0x000004) << 2);
+    }
+    return out;
+}
+
+// clocks the noise shift register for each time bit 19 goes high while the
+// accumulator goes from a to b
+void clock_noise(uint32_t& noise, uint64_t a, uint64_t b) {
+    for (uint64_t n = ((b + 0x80000) >> 20) - ((a + 0x80000) >> 20); n > 0; --n) {
+        uint32_t bit0 = ((noise >> 22) ^ (noise >> 17)) & 1;
+        noise = ((noise << 1) & 0x7fffff) | bit0;
+    }
+}
+
+} // namespace
+
+
+LiteSid::LiteSid() : m_model(Sid::Model::MOS8580) {
+    reset();
+}
+
+void LiteSid::reset() {
+    for (Voice& voice : m_voices) {
+        voice           = {};
+        voice.noise     = 0x7ffff8;
+        voice.env_state = EnvState::Release;
+        update_env_period(voice);
+    }
+    m_fc       = 0;
+    m_res_filt = 0;
+    m_mode_vol = 0;
+    m_ic1      = 0;
+    m_ic2      = 0;
+    m_dc_in    = 0;
+    m_dc_out   = 0;
+    m_until_sample = CYCLES_PER_SAMPLE;
+    m_sample_phase = 0;
+    m_wave   = {};
+    m_acc_at = {};
+    update_filter();
+}
+
+void LiteSid::set_chip_model(Sid::Model model) {
+    m_model = model;
+    update_filter();
+}
+
+void LiteSid::write(int reg, uint8_t value) {
+    if (reg < 21) {
+        Voice& voice = m_voices[reg / 7];
+        switch (reg % 7) {
+        case 0: voice.freq = (voice.freq & 0xff00) | value; break;
+        case 1: voice.freq = (voice.freq & 0x00ff) | value << 8; break;
+        case 2: voice.pw   = (voice.pw & 0xf00) | value; break;
+        case 3: voice.pw   = (voice.pw & 0x0ff) | (value & 0xf) << 8; break;
+        case 4:
+            if ((value & GATE) && !(voice.control & GATE)) voice.env_state = EnvState::Attack;
+            if (!(value & GATE) && (voice.control & GATE)) voice.env_state = EnvState::Release;
+            if (value & TEST) {
+                voice.acc   = 0;
+                voice.noise = 0x7ffff8;
+            }
+            voice.control = value;
+            break;
+        case 5: voice.attack_decay    = value; break;
+        case 6: voice.sustain_release = value; break;
+        }
+        update_env_period(voice);
+        return;
+    }
+    switch (reg) {
+    case 0x15: m_fc = (m_fc & 0x7f8) | (value & 7); update_filter(); break;
+    case 0x16: m_fc = (m_fc & 0x007) | value << 3; update_filter(); break;
+    case 0x17: m_res_filt = value; update_filter(); break;
+    case 0x18: m_mode_vol = value; break;
+    default: break;
+    }
+}
+
+void LiteSid::update_filter() {
+    float g = (m_model == Sid::Model::MOS6581 ? tables().g_6581 : tables().g_8580)[m_fc];
+    // same resonance as reSID
+    m_k  = 1.0f / (0.707f + (m_res_filt >> 4) / 15.0f);
+    m_a1 = 1.0f / (1.0f + g * (g + m_k));
+    m_a2 = g * m_a1;
+    m_a3 = g * m_a2;
+}
+
+void LiteSid::update_env_period(Voice& voice) {
+    switch (voice.env_state) {
+    case EnvState::Attack:
+        voice.env_period = RATE_PERIODS[voice.attack_decay >> 4];
+        break;
+    case EnvState::DecaySustain:
+        voice.env_period = voice.env > (voice.sustain_release >> 4) * 0x11 ? RATE_PERIODS[voice.attack_decay & 0xf] : ENV_HELD;
+        break;
+    case EnvState::Release:
+        voice.env_period = voice.env > 0 ? RATE_PERIODS[voice.sustain_release & 0xf] : ENV_HELD;
+        break;
+    }
+    // a faster rate takes over within one step, not all at once
+    voice.rate_counter = std::min(voice.rate_counter, voice.env_period - 1);
+}
+
+// called when rate_counter has reached env_period
+void LiteSid::advance_envelope(Voice& voice) {
+    if (voice.env_period == ENV_HELD) {
+        voice.rate_counter = 0;
+        return;
+    }
+    auto const& exp_periods = tables().exp_periods;
+    while (voice.rate_counter >= voice.env_period) {
+        voice.rate_counter -= voice.env_period;
+        if (voice.env_state == EnvState::Attack) {
+            if (voice.env < 0xff) ++voice.env;
+            if (voice.env == 0xff) {
+                voice.env_state = EnvState::DecaySustain;
+                update_env_period(voice);
+            }
+            continue;
+        }
+        if (++voice.exp_counter < exp_periods[voice.env]) continue;
+        voice.exp_counter = 0;
+        --voice.env;
+        update_env_period(voice);
+    }
+}
+
+// Renders a voice into m_wave. Only the steps of plain saw and pulse waves
+// are corrected, the other waveforms have little energy up high.
+void LiteSid::render_voice(int v, int length) {
+    Voice&          voice   = m_voices[v];
+    Voice const&    src     = m_voices[(v + 2) % 3];
+    uint32_t const* src_acc = m_acc_at[(v + 2) % 3].data();
+    uint32_t*       acc_at  = m_acc_at[v].data();
+    float*          out     = m_wave[v].data();
+
+    int      control  = voice.control;
+    int      waveform = control & 0xf0;
+    bool     saw      = waveform == SAW;
+    bool     pulse    = waveform == PULSE && voice.pw > 0;
+    bool     noise    = control & NOISE;
+    bool     sync     = (control & SYNC) && !(src.control & TEST) && src.freq > 0;
+    bool     test     = control & TEST;
+    uint32_t freq     = voice.freq;
+    uint32_t src_freq = src.freq;
+    uint32_t pw       = voice.pw;
+    uint32_t th       = pw << 12;
+
+    uint32_t acc          = voice.acc;
+    int      rate_counter = voice.rate_counter;
+    float    env          = float(voice.env);
+    acc_at[0] = acc;
+    for (int i = 1; i <= length; ++i) {
+        int c = m_periods[i - 1];
+        rate_counter += c;
+        if (rate_counter >= voice.env_period) {
+            voice.rate_counter = rate_counter;
+            advance_envelope(voice);
+            rate_counter = voice.rate_counter;
+            env          = float(voice.env);
+        }
+        float corr = 0;
+
+        // a step of height h, t cycles before the sample
+        auto step = [&](float t, int h) {
+            float d = std::min(t * SAMPLES_PER_CYCLE, 1.0f);
+            float e = h * env;
+            out[i - 1] += e * d * d * 0.5f;
+            corr       -= e * (1 - d) * (1 - d) * 0.5f;
+        };
+        // steps while the accumulator goes from a to b, t cycles before the sample
+        auto steps = [&](uint32_t a, uint32_t b, float t) {
+            if (saw && b >= 0x1000000) step(t + float(b - 0x1000000) / freq, -0x1000);
+            if (pulse) {
+                if (a < th && b >= th) step(t + float(b - th) / freq, 0xfff);
+                if (b >= 0x1000000) {
+                    step(t + float(b - 0x1000000) / freq, -0xfff);
+                    if (b >= th + 0x1000000) step(t + float(b - th - 0x1000000) / freq, 0xfff);
+                }
+            }
+        };
+
+        if (!test) {
+            uint32_t b     = acc + freq * c;
+            uint32_t s     = src_acc[i - 1];
+            uint32_t s_end = s + src_freq * c;
+            if (sync && s < 0x800000 && s_end >= 0x800000) {
+                // hard sync at the rising edge of the source's msb
+                float    t   = float(s_end - 0x800000) / src_freq;
+                uint32_t mid = b - std::min(uint32_t(freq * t), b - acc);
+                steps(acc, mid, t);
+                if (noise) clock_noise(voice.noise, acc, mid);
+                int before = wave_output(control, mid & 0xffffff, pw, voice.noise, 0);
+                int after  = wave_output(control, 0, pw, voice.noise, 0);
+                if (saw || pulse) step(t, after - before);
+                acc = 0;
+                b   = uint32_t(freq * t);
+            }
+            steps(acc, b, 0);
+            if (noise) clock_noise(voice.noise, acc, b);
+            acc = b & 0xffffff;
+        }
+        acc_at[i] = acc;
+
+        int w;
+        switch (waveform) {
+        case SAW:   w = acc >> 12; break;
+        case PULSE: w = test || (acc >> 12) >= pw ? 0xfff : 0; break;
+        default:    w = wave_output(control, acc, pw, voice.noise, src_acc[i]); break;
+        }
+        out[i] = (w - 0x800) * env + corr;
+    }
+    voice.acc          = acc;
+    voice.rate_counter = rate_counter;
+}
+
+void LiteSid::render(int16_t* buffer, int length) {
+    // voices that depend on their neighbor last, so its accumulators are ready
+    for (int v = 0; v < 3; ++v) {
+        if (!(m_voices[v].control & (SYNC | RING))) render_voice(v, length);
+    }
+    for (int v = 0; v < 3; ++v) {
+        if (m_voices[v].control & (SYNC | RING)) render_voice(v, length);
+    }
+
+    std::array<float, 3> direct;
+    std::array<float, 3> filtered;
+    for (int v = 0; v < 3; ++v) {
+        bool filt   = (m_res_filt >> v) & 1;
+        bool off    = v == 2 && !filt && (m_mode_vol & VOICE3OFF);
+        direct[v]   = filt || off ? 0 : 1;
+        filtered[v] = filt;
+    }
+    // reSID's low-pass and high-pass outputs are inverted, so are these
+    float lp  = m_mode_vol & LOWPASS ? -1 : 0;
+    float bp  = m_mode_vol & BANDPASS ? 1 : 0;
+    float hp  = m_mode_vol & HIGHPASS ? -1 : 0;
+    float vol = m_mode_vol & 0xf;
+
+    float const* w0 = m_wave[0].data();
+    float const* w1 = m_wave[1].data();
+    float const* w2 = m_wave[2].data();
+    for (int i = 0; i < length; ++i) {
+        float d  = direct[0] * w0[i] + direct[1] * w1[i] + direct[2] * w2[i];
+        float in = filtered[0] * w0[i] + filtered[1] * w1[i] + filtered[2] * w2[i];
+
+        // trapezoidal state-variable filter, which stays stable up to the highest cutoff
+        float v3 = in - m_ic2;
+        float v1 = m_a1 * m_ic1 + m_a2 * v3;
+        float v2 = m_ic2 + m_a2 * m_ic1 + m_a3 * v3;
+        m_ic1 = 2 * v1 - m_ic1;
+        m_ic2 = 2 * v2 - m_ic2;
+        float f = lp * v2 + bp * v1 + hp * (in - m_k * v1 - v2);
+
+        float out = (d + f) * vol;
+        m_dc_out = out - m_dc_in + DC_POLE * m_dc_out;
+        m_dc_in  = out;
+        int s = int(m_dc_out * OUTPUT_SCALE);
+        buffer[i] = std::max(-0x8000, std::min(0x7fff, s));
+    }
+    for (int v = 0; v < 3; ++v) m_wave[v][0] = m_wave[v][length];
+}
+
+int LiteSid::clock(int cycles, int16_t* buffer, int length) {
+    int s = 0;
+    while (s < length && cycles >= m_until_sample) {
+        int n = 0;
+        while (n < BLOCK && s + n < length && cycles >= m_until_sample) {
+            cycles -= m_until_sample;
+            m_periods[n++] = m_until_sample;
+            m_until_sample = CYCLES_PER_SAMPLE;
+            m_sample_phase += CYCLES_PER_SAMPLE_RMD;
+            if (m_sample_phase >= Sid::MIXRATE) {
+                m_sample_phase -= Sid::MIXRATE;
+                ++m_until_sample;
+            }
+        }
+        render(buffer + s, n);
+        s += n;
+    }
+    // the remaining cycles are rendered with the next sample
+    if (s < length) m_until_sample -= cycles;
+    return s;
+}
+
+// advance the chip without producing samples
+void LiteSid::clock(int cycles) {
+    for (Voice& voice : m_voices) {
+        voice.rate_counter += cycles;
+        if (voice.rate_counter >= voice.env_period) advance_envelope(voice);
+        if (voice.control & TEST) continue;
+        uint64_t b = voice.acc + uint64_t(voice.freq) * cycles;
+        clock_noise(voice.noise, voice.acc, b);
+        voice.acc = b & 0xffffff;
+    }
+}
+
+std::array<float, 3> LiteSid::get_env_levels() const {
+    std::array<float, 3> levels = {};
+    for (int c = 0; c < 3; ++c) {
+        if (m_voices[c].control & 0xf0) levels[c] = m_voices[c].env * (1.0f / 0xff);
+    }
+    return levels;
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include "sid.hpp"
+#include <array>
+#include <cstdint>
+
+
+// A cheap approximation of the SID for previews and slow devices. Instead of
+// clocking the chip cycle by cycle like reSID, it computes the oscillators
+// once per output sample and smooths their steps with polynomial
+// band-limited step corrections. Envelopes are stepped from rate tables, and
+// the filter is a digital state-variable filter that follows reSID's cutoff
+// curves. Register writes take effect at the next sample. reSID remains the
+// reference, this is only meant to sound close.
+class LiteSid {
+public:
+    LiteSid();
+    void                 reset();
+    void                 set_chip_model(Sid::Model model);
+    void                 write(int reg, uint8_t value);
+    int                  clock(int cycles, int16_t* buffer, int length);
+    void                 clock(int cycles);
+    std::array<float, 3> get_env_levels() const;
+
+private:
+    enum { BLOCK = 256 };
+    enum class EnvState { Attack, DecaySustain, Release };
+
+    struct Voice {
+        uint32_t acc;   // 24 bit phase accumulator
+        uint32_t noise; // 23 bit noise shift register
+        uint32_t freq;
+        uint32_t pw;    // 12 bits
+        uint8_t  control;
+        uint8_t  attack_decay;
+        uint8_t  sustain_release;
+
+        EnvState env_state;
+        int      env;          // envelope counter, 0 to 0xff
+        int      rate_counter; // cycles since the last envelope step
+        int      env_period;   // cycles per envelope step
+        int      exp_counter;  // envelope steps until the counter changes while decaying
+    };
+
+    void  render(int16_t* buffer, int length);
+    void  render_voice(int v, int length);
+    void  advance_envelope(Voice& voice);
+    void  update_env_period(Voice& voice);
+    void  update_filter();
+
+    std::array<Voice, 3> m_voices;
+    Sid::Model           m_model;
+
+    // filter registers
+    int     m_fc;
+    uint8_t m_res_filt;
+    uint8_t m_mode_vol;
+
+    // state-variable filter
+    float m_k;
+    float m_a1;
+    float m_a2;
+    float m_a3;
+    float m_ic1;
+    float m_ic2;
+
+    // output high-pass, like reSID's external filter
+    float m_dc_in;
+    float m_dc_out;
+
+    int m_until_sample; // cycles until the next sample
+    int m_sample_phase; // fractional cycles of the sample period
+
+    // Voice outputs of the current block. They lag one sample behind, so that
+    // a step can correct both of its neighboring samples, and index 0 holds
+    // the last sample of the previous block.
+    std::array<std::array<float, BLOCK + 1>, 3>    m_wave;
+    std::array<std::array<uint32_t, BLOCK + 1>, 3> m_acc_at;  // accumulators at the samples
+    std::array<uint8_t, BLOCK>                     m_periods; // cycles before each sample
+};
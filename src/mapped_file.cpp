@@ -0,0 +1,99 @@
+#include "mapped_file.hpp"
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <unistd.h>
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(__EMSCRIPTEN__)
+#define MAPPED_FILE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+MappedFile::MappedFile(MappedFile&& other) noexcept {
+    *this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if (this == &other) return *this;
+    close();
+    m_mapped = other.m_mapped;
+    m_buffer = std::move(other.m_buffer);
+    m_data   = m_mapped ? other.m_data : m_buffer.data();
+    m_size   = other.m_size;
+    other.m_data   = nullptr;
+    other.m_size   = 0;
+    other.m_mapped = false;
+    other.m_buffer = {};
+    return *this;
+}
+
+bool MappedFile::open(char const* path) {
+    close();
+#ifdef MAPPED_FILE_MMAP
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        ::close(fd);
+        return false;
+    }
+    // mmap can't map empty files, they simply have no data
+    if (st.st_size > 0) {
+        void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            m_data   = (uint8_t const*) p;
+            m_size   = st.st_size;
+            m_mapped = true;
+        }
+    }
+    ::close(fd);
+    if (m_mapped || st.st_size == 0) return true;
+#endif
+    FILE* f = fopen(path, "rb");
+    if (!f) return false;
+    bool ok = fseek(f, 0, SEEK_END) == 0;
+    long size = ok ? ftell(f) : -1;
+    ok = size >= 0 && fseek(f, 0, SEEK_SET) == 0;
+    if (ok) {
+        m_buffer.resize(size);
+        ok = fread(m_buffer.data(), 1, size, f) == size_t(size);
+    }
+    fclose(f);
+    if (!ok) {
+        m_buffer = {};
+        return false;
+    }
+    m_data = m_buffer.data();
+    m_size = m_buffer.size();
+    return true;
+}
+
+void MappedFile::close() {
+#ifdef MAPPED_FILE_MMAP
+    if (m_mapped) munmap((void*) m_data, m_size);
+#endif
+    m_data   = nullptr;
+    m_size   = 0;
+    m_mapped = false;
+    m_buffer = {};
+}
+
+
+bool write_file(char const* path, char const* mode, void const* data, size_t size) {
+    FILE* f = fopen(path, mode);
+    if (!f) return false;
+    bool ok = fwrite(data, 1, size, f) == size;
+    ok &= fflush(f) == 0;
+    ok &= fsync(fileno(f)) == 0;
+    ok &= fclose(f) == 0;
+    return ok;
+}
+
+bool write_file_atomic(char const* path, void const* data, size_t size) {
+    std::string tmp_path = std::string(path) + ".tmp";
+    bool ok = write_file(tmp_path.c_str(), "wb", data, size) && rename(tmp_path.c_str(), path) == 0;
+    if (!ok) remove(tmp_path.c_str());
+    return ok;
+}
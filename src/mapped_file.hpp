@@ -0,0 +1,36 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Read-only contents of a whole file. Where mmap is available the file is
+// mapped, otherwise it is read with a single sized read. The contents stay
+// valid until the file is closed or the MappedFile is destroyed.
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+    MappedFile(MappedFile const&) = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+    ~MappedFile() { close(); }
+
+    bool           open(char const* path);
+    void           close();
+    uint8_t const* data() const { return m_data; }
+    size_t         size() const { return m_size; }
+
+private:
+    uint8_t const*       m_data = nullptr;
+    size_t               m_size = 0;
+    bool                 m_mapped = false;
+    std::vector<uint8_t> m_buffer; // contents when not mapped
+};
+
+
+// Writes the data with fopen mode "wb" or "ab" and waits until it is on disk.
+bool write_file(char const* path, char const* mode, void const* data, size_t size);
+
+// Writes the data to path + ".tmp" and renames that over path, so a crash or
+// full disk leaves either the old or the new file, never a truncated one.
+bool write_file_atomic(char const* path, void const* data, size_t size);
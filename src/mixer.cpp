@@ -0,0 +1,190 @@
+#include "mixer.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+
+namespace {
+
+enum {
+    REG_COUNT        = 25,
+    REG_WRITE_CYCLES = 14,
+    MAX_SEEK_MINUTES = 30,
+};
+
+// NOTE: this is an extract from the GoatTracker changelog
+// 15 January 2009
+// v2.68
+//           - SID register write order tweaked to resemble JCH NewPlayer 21.
+//           - Unbuffered playroutine optimized & modified to resemble buffered
+//             mode timing more.
+// ...
+// 23 July 2014
+// v2.73     - Reverted to old playroutine timing.
+//           - Added full buffering option (similar to ZP ghostregs) which will
+//             buffer everything to ghost regs and dump the previous frame to the
+//             SID at the beginning of the play call
+constexpr uint8_t REG_ORDERS[2][2][REG_COUNT] = {
+    // v2.68
+    {
+        {
+            0x15, 0x16, 0x18, 0x17,                   //
+            0x05, 0x06, 0x02, 0x03, 0x00, 0x01, 0x04, //
+            0x0c, 0x0d, 0x09, 0x0a, 0x07, 0x08, 0x0b, //
+            0x13, 0x14, 0x10, 0x11, 0x0e, 0x0f, 0x12, //
+        },
+        {
+            0x15, 0x16, 0x18, 0x17,                   //
+            0x04, 0x00, 0x01, 0x02, 0x03, 0x05, 0x06, //
+            0x0b, 0x07, 0x08, 0x09, 0x0a, 0x0c, 0x0d, //
+            0x12, 0x0e, 0x0f, 0x10, 0x11, 0x13, 0x14, //
+        },
+    },
+    // v2.73
+    {
+        {
+            0x18, 0x17, 0x16, 0x15,                   //
+            0x14, 0x13, 0x12, 0x11, 0x10, 0x0f, 0x0e, //
+            0x0d, 0x0c, 0x0b, 0x0a, 0x09, 0x08, 0x07, //
+            0x06, 0x05, 0x04, 0x03, 0x02, 0x01, 0x00, //
+        },
+        {
+            0x00, 0x01, 0x02, 0x03,                   //
+            0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, //
+            0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10, 0x11, //
+            0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, //
+        },
+    },
+};
+
+} // namespace
+
+
+int ticks_per_second(gt::Song const& song) {
+    int t = song.multiplier * 50;
+    return t ? t : 25;
+}
+
+
+int song_length(gt::Song const& song) {
+    gt::Player player{ song };
+    player.set_action(gt::Player::Action::Start);
+    uint32_t tick_count = 1;
+    while (player.channel_loop_counter(0) == 0) {
+        player.play_routine();
+        ++tick_count;
+    }
+    tick_count += player.channel_tempo(0);
+    uint64_t const cycles_per_tick = Sid::CLOCKRATE_PAL / ticks_per_second(song);
+    uint64_t cycles = cycles_per_tick * tick_count;
+    return cycles * Sid::MIXRATE / Sid::CLOCKRATE_PAL;
+}
+
+
+void Mixer::reset() {
+    m_cycles_to_next_write = 0;
+    m_reg                  = 0;
+}
+
+
+void Mixer::write_register() {
+    uint8_t const* reg_order =
+        REG_ORDERS[m_register_write_order][m_player.song().adparam >= 0xf000];
+
+    if (m_reg == 0) m_player.play_routine();
+    // write register
+    int r = reg_order[m_reg];
+    m_sid.set_reg(r, m_player.registers()[r]);
+    // next register
+    if (++m_reg >= REG_COUNT) {
+        m_reg = 0;
+        int const cycles_per_tick = Sid::CLOCKRATE_PAL / ticks_per_second(m_player.song());
+        m_cycles_to_next_write = cycles_per_tick - REG_WRITE_CYCLES * (REG_COUNT - 1);
+    }
+    else {
+        m_cycles_to_next_write = REG_WRITE_CYCLES;
+    }
+}
+
+
+// Test notes and releases start at the next register write slot, also while
+// a song plays, rather than at the channel's next tick. The channel's
+// registers go to the SID together, envelope before waveform, and a hard
+// restart closes the gate first so the envelope restarts.
+void Mixer::start_notes() {
+    for (int c = 0; c < gt::MAX_CHN; ++c) {
+        if (!m_player.note_pending(c)) continue;
+        bool hard_restart = m_player.start_note(c);
+        gt::Player::Registers const& regs = m_player.registers();
+        int const base = c * 7;
+        if (hard_restart) m_sid.set_reg(base + 4, regs[base + 4] & 0xfe);
+        for (int r : { 5, 6, 2, 3, 0, 1, 4 }) m_sid.set_reg(base + r, regs[base + r]);
+    }
+}
+
+
+// Replays the song from the beginning, the same ticks and register writes
+// that mix would do, but clocks the SID without producing samples.
+bool Mixer::fast_forward(int song_pos, std::atomic<bool> const& canceled) {
+    m_player.set_action(gt::Player::Action::Start);
+    int const max_ticks = ticks_per_second(m_player.song()) * 60 * MAX_SEEK_MINUTES;
+    for (int tick = 0; tick < max_ticks; ++tick) {
+        if (tick > 0) {
+            if (m_player.m_current_song_pos[0] == song_pos) return true;
+            if (m_player.channel_loop_counter(0) > 0) break;
+        }
+        if (canceled.load(std::memory_order_relaxed)) return false;
+        do {
+            write_register();
+            m_sid.clock(m_cycles_to_next_write);
+            m_cycles_to_next_write = 0;
+        } while (m_reg != 0);
+    }
+    return false;
+}
+
+
+void Mixer::seek(std::shared_ptr<Seek> seek) {
+    std::lock_guard<std::mutex> lock(m_seek_mutex);
+    // the previous seek holds either a state that was never taken or the one swapped out
+    m_seek       = std::move(seek);
+    m_seek_taken = false;
+}
+
+void Mixer::take_seek() {
+    std::unique_lock<std::mutex> lock(m_seek_mutex, std::try_to_lock);
+    if (!lock || !m_seek || m_seek_taken) return;
+    m_seek_taken = true;
+    gt::Player& player = m_seek->player;
+    player.set_song(m_player.song());
+    player.set_pattern_loopping(m_player.get_pattern_looping());
+    for (int c = 0; c < gt::MAX_CHN; ++c) player.set_channel_active(c, m_player.is_channel_active(c));
+    std::swap(m_player, player);
+    std::swap(m_sid, m_seek->sid);
+    m_reg                  = m_seek->mixer.m_reg;
+    m_cycles_to_next_write = m_seek->mixer.m_cycles_to_next_write;
+}
+
+
+void Mixer::mix(int16_t* buffer, int length) {
+    take_seek();
+
+    int cycles_left = length * uint64_t(Sid::CLOCKRATE_PAL) / Sid::MIXRATE;
+    while (cycles_left > 0) {
+        start_notes();
+        if (m_cycles_to_next_write == 0) write_register();
+        int c = std::min(cycles_left, m_cycles_to_next_write);
+        cycles_left -= c;
+        m_cycles_to_next_write -= c;
+        int n = m_sid.clock(c, buffer, length);
+        buffer += n;
+        length -= n;
+    }
+    // sometimes there's a sample left that needs rendering
+    assert(length <= 1);
+    if (length > 0) {
+        m_sid.clock(9999, buffer, length);
+    }
+}
+
+
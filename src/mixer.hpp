@@ -0,0 +1,56 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include "gtplayer.hpp"
+#include "gtsong.hpp"
+#include "sid.hpp"
+
+
+// Drives the player and writes its registers to the SID with GoatTracker's timing.
+class Mixer {
+public:
+    struct Seek;
+
+    Mixer(gt::Player& player, Sid& sid) : m_player(player), m_sid(sid) {}
+    void mix(int16_t* buffer, int length);
+    // Off the audio thread: replay the song from the start until channel 0
+    // enters the order position, with the SID clocked all the way, so player
+    // and SID end up exactly where playback would have. Returns false if the
+    // position isn't reached before the song loops or the replay is canceled.
+    bool fast_forward(int song_pos, std::atomic<bool> const& canceled);
+    // UI thread: the next mix call swaps in the seek's player, SID and write state,
+    // keeping the current song, mutes and pattern loop
+    void seek(std::shared_ptr<Seek> seek);
+    void reset(); // forget the register write state, e.g. before a new song
+    void set_register_write_order(int order) { m_register_write_order = order; } // 0: v2.68, 1: v2.73
+
+private:
+    void write_register();
+    void start_notes();
+    void take_seek();
+
+    gt::Player& m_player;
+    Sid&        m_sid;
+    int         m_cycles_to_next_write = 0;
+    int         m_reg                  = 0;
+    int         m_register_write_order = 1;
+
+    std::mutex            m_seek_mutex; // the audio thread only tries it, and never frees a seek
+    std::shared_ptr<Seek> m_seek;
+    bool                  m_seek_taken = false;
+};
+
+
+// A player and SID of its own for a mixer to replay a song up to a seek target.
+struct Mixer::Seek {
+    explicit Seek(gt::Song const& song) : player(song), mixer(player, sid) {}
+    gt::Player player;
+    Sid        sid;
+    Mixer      mixer;
+};
+
+
+int ticks_per_second(gt::Song const& song);
+int song_length(gt::Song const& song); // in samples, until the song loops
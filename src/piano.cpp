@@ -275,7 +275,7 @@ void draw() {
 
     int chan = song_view::channel();
     if (g_gate && (!prev_gate || g_note != prev_note)) {
-        app::player().play_test_note(g_note + gt::FIRSTNOTE, g_instrument, chan);
+        app::player().play_test_note(app::song(), g_note + gt::FIRSTNOTE, g_instrument, chan);
         g_note_on = true;
     }
     if (!g_gate && prev_gate) {
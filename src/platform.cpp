@@ -1,10 +1,12 @@
 #define SDL_MAIN_HANDLED
 #include <SDL2/SDL.h>
+#ifndef GFX_SOFTWARE
 #include <GL/glew.h>
-#include <fstream>
+#endif
 #include <filesystem>
 #include <algorithm>
 #include "platform.hpp"
+#include "mapped_file.hpp"
 #include "app.hpp"
 #include "gui.hpp"
 #include "log.hpp"
@@ -46,7 +48,11 @@ void stop_audio() {
 }
 
 enum {
-    MAX_MIDI_EVENTS = 64,
+    MAX_MIDI_EVENTS   = 64,
+    // portmidi can't wake up SDL_WaitEventTimeout, so poll it
+    MIDI_POLL_MS      = 10,
+    // input latency while the browser loop is throttled
+    WEB_INPUT_POLL_MS = 50,
 };
 
 bool init_midi() {
@@ -79,6 +85,29 @@ void free_midi() {
 }
 
 
+#ifdef GFX_SOFTWARE
+// copy the software rendered screen into the window
+void present() {
+    SDL_Surface* surface = SDL_GetWindowSurface(g_window);
+    if (!surface) return;
+    ivec2 size = gfx::screen_size();
+    int w = std::min(size.x, surface->w);
+    int h = std::min(size.y, surface->h);
+    uint8_t const* pixels = gfx::screen_pixels();
+    SDL_LockSurface(surface);
+    for (int y = 0; y < h; ++y) {
+        uint8_t const* src = pixels + (size.y - 1 - y) * size.x * 4;
+        uint32_t* dst = (uint32_t*) ((uint8_t*) surface->pixels + y * surface->pitch);
+        for (int x = 0; x < w; ++x, src += 4) {
+            dst[x] = SDL_MapRGB(surface->format, src[0], src[1], src[2]);
+        }
+    }
+    SDL_UnlockSurface(surface);
+    SDL_UpdateWindowSurface(g_window);
+}
+#endif
+
+
 void main_loop() {
 
 #ifdef __EMSCRIPTEN__
@@ -88,6 +117,13 @@ void main_loop() {
         emscripten_get_canvas_element_size("#canvas", &w, &h);
         if (w != ow || h != oh) SDL_SetWindowSize(g_window, w, h);
     }
+#else
+    // sleep until there's input or the app wants the next frame
+    int timeout = app::frame_timeout();
+#ifdef PORTMIDI
+    if (g_midi_stream) timeout = std::min<int>(timeout, MIDI_POLL_MS);
+#endif
+    if (timeout > 0) SDL_WaitEventTimeout(nullptr, timeout);
 #endif
 
     SDL_Event e;
@@ -122,6 +158,9 @@ void main_loop() {
             if (e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
                 app::resize(e.window.data1, e.window.data2);
             }
+            if (e.window.event == SDL_WINDOWEVENT_EXPOSED) {
+                app::request_redraw();
+            }
             break;
 
         case SDL_MOUSEBUTTONDOWN:
@@ -141,8 +180,29 @@ void main_loop() {
         }
     }
 
-    app::draw();
-    SDL_GL_SwapWindow(g_window);
+#ifdef PORTMIDI
+    // pending midi input is handled by the piano during drawing
+    if (g_midi_stream && Pm_Poll(g_midi_stream) > 0) app::request_redraw();
+#endif
+
+    if (app::draw()) {
+#ifdef GFX_SOFTWARE
+        present();
+#else
+        SDL_GL_SwapWindow(g_window);
+#endif
+    }
+
+#ifdef __EMSCRIPTEN__
+    // the browser loop can't block, so throttle it while the app is idle
+    static int loop_timeout = 0;
+    int timeout = std::min<int>(app::frame_timeout(), WEB_INPUT_POLL_MS);
+    if (timeout != loop_timeout) {
+        loop_timeout = timeout;
+        if (timeout > 0) emscripten_set_main_loop_timing(EM_TIMING_SETTIMEOUT, timeout);
+        else emscripten_set_main_loop_timing(EM_TIMING_RAF, 1);
+    }
+#endif
 }
 
 
@@ -153,14 +213,15 @@ void main_loop() {
 
 namespace platform {
 
-bool load_asset(std::string const& name, std::vector<uint8_t>& buf) {
-    std::ifstream f("assets/" + name, std::ios::in | std::ios::binary);
-    if (!f.is_open()) {
+bool load_asset(std::string const& name, Asset& asset) {
+    auto file = std::make_shared<MappedFile>();
+    if (!file->open(("assets/" + name).c_str())) {
         LOGE("load_asset: could not open %s", name.c_str());
         return false;
     }
-    buf = std::vector<uint8_t>((std::istreambuf_iterator<char>(f)),
-                                std::istreambuf_iterator<char>());
+    asset.data  = file->data();
+    asset.size  = file->size();
+    asset.owner = std::move(file);
     return true;
 }
 
@@ -211,6 +272,14 @@ int main(int argc, char** argv) {
     if (argc == 2) app::set_import_song_path(argv[1]);
 
     SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO);
+#ifdef GFX_SOFTWARE
+    g_window = SDL_CreateWindow(
+            "GTMobile",
+            SDL_WINDOWPOS_UNDEFINED,
+            SDL_WINDOWPOS_UNDEFINED,
+            app::CANVAS_WIDTH, app::CANVAS_MIN_HEIGHT,
+            SDL_WINDOW_RESIZABLE);
+#else
     SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
     SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 0);
 
@@ -233,6 +302,7 @@ int main(int argc, char** argv) {
     SDL_GL_SetSwapInterval(1);
     glewExperimental = true;
     glewInit();
+#endif
 
     init_midi();
     start_audio();
@@ -249,7 +319,9 @@ int main(int argc, char** argv) {
     stop_audio();
     free_midi();
 
+#ifndef GFX_SOFTWARE
     SDL_GL_DeleteContext(gl_context);
+#endif
     SDL_DestroyWindow(g_window);
     SDL_Quit();
     return 0;
@@ -1,11 +1,20 @@
 #pragma once
 #include <string>
 #include <vector>
+#include <memory>
 #include <cstdint>
 
 
 namespace platform {
-    bool load_asset(std::string const& name, std::vector<uint8_t>& buf);
+    // Read-only asset contents. They are mapped or read in one go by the
+    // platform and stay valid as long as the asset holds on to its owner.
+    struct Asset {
+        uint8_t const*        data = nullptr;
+        size_t                size = 0;
+        std::shared_ptr<void> owner;
+    };
+
+    bool load_asset(std::string const& name, Asset& asset);
     std::vector<std::string> list_assets(std::string const& dir);
     void show_keyboard(bool enabled);
     void export_song(std::string const& path, std::string const& title);
@@ -0,0 +1,273 @@
+#include "profiler.hpp"
+#include "app.hpp"
+#include "gui.hpp"
+#include "log.hpp"
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+
+namespace profiler {
+namespace {
+
+enum {
+    RING_SIZE          = 1024,
+    MAX_THREADS        = 8,
+    MAX_ZONES          = 12,
+    HISTORY            = 120,
+    MAX_TRACE_EVENTS   = 1 << 16,
+    OVERLAY_HEIGHT     = 96,
+    GRAPH_HEIGHT       = 40,
+};
+
+struct Event {
+    char const* name;
+    int64_t     start;
+    int64_t     duration;
+};
+
+// Written by one thread only. The gui thread reads behind the head and
+// drops whatever the writer has lapped in the meantime. A thread claims a
+// ring on its first event and releases it when it exits, so threads that
+// come and go, like job workers, can reuse the rings. A reused ring keeps
+// its id in traces.
+struct Ring {
+    std::atomic<bool>            in_use;
+    std::atomic<uint32_t>        head;
+    uint32_t                     tail; // reader side
+    std::array<Event, RING_SIZE> events;
+};
+
+struct RingClaim {
+    Ring* ring    = nullptr;
+    bool  claimed = false;
+    ~RingClaim() {
+        if (ring) ring->in_use.store(false, std::memory_order_release);
+    }
+};
+
+struct TraceEvent {
+    Event event;
+    int   tid;
+};
+
+struct Zone {
+    char const* name;
+    float       avg_ms;
+};
+
+using Clock = std::chrono::steady_clock;
+
+Clock::time_point              g_epoch = Clock::now();
+std::atomic<bool>              g_enabled;
+std::array<Ring, MAX_THREADS>  g_rings;
+thread_local RingClaim         t_claim;
+
+// audio thread stats
+std::atomic<float>             g_audio_load;
+std::atomic<float>             g_audio_peak;
+std::atomic<int>               g_audio_late;
+std::atomic<int>               g_audio_underruns{ -1 };
+
+// gui thread state
+std::vector<TraceEvent>        g_trace;
+std::array<Zone, MAX_ZONES>    g_zones;
+int                            g_zone_count;
+std::array<float, HISTORY>     g_frame_history;
+int                            g_frame_pos;
+float                          g_audio_peak_display;
+
+
+Ring* ring() {
+    if (!t_claim.claimed) {
+        t_claim.claimed = true;
+        for (Ring& r : g_rings) {
+            bool in_use = false;
+            if (!r.in_use.compare_exchange_strong(in_use, true, std::memory_order_acquire)) continue;
+            t_claim.ring = &r;
+            break;
+        }
+        if (!t_claim.ring) LOGW("profiler: too many threads");
+    }
+    return t_claim.ring;
+}
+
+void push(Event const& e) {
+    Ring* r = ring();
+    if (!r) return;
+    uint32_t h = r->head.load(std::memory_order_relaxed);
+    r->events[h % RING_SIZE] = e;
+    r->head.store(h + 1, std::memory_order_release);
+}
+
+void add_to_zone(Event const& e) {
+    float ms = e.duration * 1e-6f;
+    int i = 0;
+    while (i < g_zone_count && g_zones[i].name != e.name) ++i;
+    if (i == g_zone_count) {
+        if (g_zone_count == MAX_ZONES) return;
+        g_zones[g_zone_count++] = { e.name, ms };
+    }
+    g_zones[i].avg_ms += (ms - g_zones[i].avg_ms) * 0.05f;
+}
+
+void add_to_trace(Event const& e, int tid) {
+    if (g_trace.size() >= MAX_TRACE_EVENTS) {
+        g_trace.erase(g_trace.begin(), g_trace.begin() + MAX_TRACE_EVENTS / 2);
+    }
+    g_trace.push_back({ e, tid });
+}
+
+void print(gui::DrawContext& dc, ivec2 pos, char const* fmt, ...) __attribute__((format(printf, 3, 4)));
+void print(gui::DrawContext& dc, ivec2 pos, char const* fmt, ...) {
+    char str[64];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(str, sizeof(str), fmt, args);
+    va_end(args);
+    // the font only has upper case letters
+    for (char* p = str; *p; ++p) *p = toupper(*p);
+    dc.text(pos, str);
+}
+
+} // namespace
+
+
+Scope::Scope(char const* name) : m_name(name), m_start(g_enabled.load(std::memory_order_relaxed) ? now_ns() : -1) {}
+
+Scope::~Scope() {
+    if (m_start < 0) return;
+    push({ m_name, m_start, now_ns() - m_start });
+}
+
+
+void enable(bool enabled) {
+    if (g_enabled == enabled) return;
+    g_enabled = enabled;
+    if (!enabled) {
+        g_trace.clear();
+        g_zone_count = 0;
+        g_frame_history = {};
+    }
+}
+bool enabled() { return g_enabled.load(std::memory_order_relaxed); }
+
+int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - g_epoch).count();
+}
+
+
+void audio_callback(int64_t start_ns, int64_t end_ns, int length) {
+    if (!g_enabled) return;
+    push({ "audio_callback", start_ns, end_ns - start_ns });
+    // the callback must finish before its samples are due
+    float deadline = length * (1e9f / app::MIXRATE);
+    float load     = (end_ns - start_ns) / deadline;
+    g_audio_load = load;
+    if (load > g_audio_peak) g_audio_peak = load; // only this thread raises it
+    if (load > 1.0f) ++g_audio_late;
+}
+
+void audio_underruns(int count) {
+    g_audio_underruns = count;
+}
+
+
+void update() {
+    if (!g_enabled) return;
+    for (int tid = 0; tid < MAX_THREADS; ++tid) {
+        Ring& r = g_rings[tid];
+        uint32_t head = r.head.load(std::memory_order_acquire);
+        if (head - r.tail > RING_SIZE) r.tail = head - RING_SIZE;
+        static std::array<Event, RING_SIZE> events;
+        uint32_t count = head - r.tail;
+        for (uint32_t i = 0; i < count; ++i) events[i] = r.events[(r.tail + i) % RING_SIZE];
+        // skip entries that were overwritten while copying, including the
+        // one the writer may be overwriting right now
+        uint32_t lapped = r.head.load(std::memory_order_acquire) - RING_SIZE + 1;
+        uint32_t first  = int32_t(lapped - r.tail) > 0 ? lapped - r.tail : 0;
+        for (uint32_t i = first; i < count; ++i) {
+            Event const& e = events[i];
+            add_to_zone(e);
+            add_to_trace(e, tid);
+            if (strcmp(e.name, "app::draw") == 0) {
+                g_frame_history[g_frame_pos] = e.duration * 1e-6f;
+                g_frame_pos = (g_frame_pos + 1) % HISTORY;
+            }
+        }
+        r.tail = head;
+    }
+    g_audio_peak_display = std::max(g_audio_peak.exchange(0.0f), g_audio_peak_display * 0.98f);
+}
+
+
+void draw() {
+    if (!g_enabled) return;
+    gui::DrawContext& dc = gui::draw_context();
+    gui::Box box = { { 0, app::canvas_height() - app::TAB_HEIGHT - gui::FRAME_WIDTH - OVERLAY_HEIGHT },
+                     { app::CANVAS_WIDTH, OVERLAY_HEIGHT } };
+    dc.rgb(color::BLACK);
+    dc.alpha(200);
+    dc.fill(box);
+    dc.alpha(255);
+
+    // frame time graph, one pixel per half millisecond
+    int bar_width = app::CANVAS_WIDTH / HISTORY;
+    int base      = box.pos.y + GRAPH_HEIGHT;
+    for (int i = 0; i < HISTORY; ++i) {
+        float ms = g_frame_history[(g_frame_pos + i) % HISTORY];
+        int h = std::min<int>(ms * 2, GRAPH_HEIGHT);
+        dc.rgb(ms > 1000.0f / 60 ? color::RED : color::GREEN);
+        dc.fill({ { i * bar_width, base - h }, { bar_width, h } });
+    }
+    dc.rgb(color::DARK_GREY);
+    dc.fill({ { 0, base - 33 }, { app::CANVAS_WIDTH, 1 } }); // 60 fps
+
+    dc.rgb(color::WHITE);
+    ivec2 p = { 4, base + 4 };
+    float frame_ms = g_frame_history[(g_frame_pos + HISTORY - 1) % HISTORY];
+    print(dc, p, "frame %5.2fms  audio %3d%% peak %3d%%", frame_ms,
+          int(g_audio_load * 100), int(g_audio_peak_display * 100));
+    p.y += 10;
+    int underruns = g_audio_underruns;
+    if (underruns >= 0) print(dc, p, "late callbacks %d  underruns %d", int(g_audio_late), underruns);
+    else print(dc, p, "late callbacks %d", int(g_audio_late));
+    p.y += 10;
+    dc.rgb(color::LIGHT_GREY);
+    for (int i = 0; i < g_zone_count && p.y + 8 <= box.pos.y + box.size.y; ++i) {
+        ivec2 q = { i % 2 == 0 ? 4 : app::CANVAS_WIDTH / 2 + 4, p.y };
+        print(dc, q, "%-15.15s%6.2f", g_zones[i].name, g_zones[i].avg_ms);
+        if (i % 2 == 1) p.y += 10;
+    }
+}
+
+
+bool export_trace(std::string const& path) {
+    std::ofstream f(path);
+    if (!f.is_open()) {
+        LOGE("profiler::export_trace: could not open %s", path.c_str());
+        return false;
+    }
+    f << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    char line[256];
+    for (size_t i = 0; i < g_trace.size(); ++i) {
+        TraceEvent const& t = g_trace[i];
+        snprintf(line, sizeof(line),
+                 "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}%s\n",
+                 t.event.name, t.tid, t.event.start * 1e-3, t.event.duration * 1e-3,
+                 i + 1 < g_trace.size() ? "," : "");
+        f << line;
+    }
+    f << "]}\n";
+    LOGI("profiler::export_trace: %zu events written to %s", g_trace.size(), path.c_str());
+    return f.good();
+}
+
+
+} // namespace profiler
@@ -0,0 +1,37 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+
+namespace profiler {
+
+    // Times the enclosing scope. Events go to a lock-free ring buffer owned
+    // by the calling thread, so this is safe to use in the audio callback.
+    // The name must outlive the profiler, i.e. be a string literal.
+    class Scope {
+    public:
+        explicit Scope(char const* name);
+        ~Scope();
+    private:
+        char const* m_name;
+        int64_t     m_start;
+    };
+
+    void enable(bool enabled);
+    bool enabled();
+
+    // time spent rendering length samples, compared against their duration
+    void audio_callback(int64_t start_ns, int64_t end_ns, int length);
+    void audio_underruns(int count); // as reported by the audio backend
+    int64_t now_ns();
+
+    void update(); // collect events, once per frame on the gui thread
+    void draw();   // overlay with frame times and audio load
+    bool export_trace(std::string const& path); // chrome trace json
+
+} // namespace profiler
+
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#define PROFILE_SCOPE(name) profiler::Scope PROFILE_CONCAT(profile_scope_, __LINE__)(name)
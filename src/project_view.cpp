@@ -1,15 +1,19 @@
 #include "project_view.hpp"
 #include "app.hpp"
 #include "gui.hpp"
+#include "jobs.hpp"
 #include "platform.hpp"
 #include "piano.hpp"
+#include "settings_view.hpp"
+#include "song_journal.hpp"
 #include "song_undo.hpp"
+#include "song_version.hpp"
 #include "song_view.hpp"
 #include <algorithm>
 #include <cstdio>
 #include <filesystem>
 #include <cstring>
-#include <thread>
+#include <memory>
 #include <cassert>
 #ifndef __EMSCRIPTEN__
 #include <sndfile.h>
@@ -33,14 +37,14 @@ std::vector<std::string> g_demo_names;
 std::vector<std::string> g_user_names;
 int                      g_file_scroll;
 int                      g_demo_scroll;
+jobs::Handle             g_scan_job;
+bool                     g_scan_stale; // the list changed while the scan was running
+jobs::Handle             g_save_job;
 
 bool                     g_show_export_window;
 ExportFormat             g_export_format;
 #ifndef __EMSCRIPTEN__
-std::thread              g_export_thread;
-bool                     g_export_canceled;
-bool                     g_export_done;
-float                    g_export_progress;
+jobs::Handle             g_export_job;
 std::string              g_export_dir;
 #endif
 
@@ -54,28 +58,94 @@ void copy_name(std::array<char, N>& dst, char const* src) {
 }
 
 
+bool name_less(std::string const& a, std::string const& b) {
+    return strcasecmp(a.c_str(), b.c_str()) < 0;
+}
+
+// keep the user song list in sync without rescanning the directory
+void add_user_name(std::string const& name) {
+    auto it = std::lower_bound(g_user_names.begin(), g_user_names.end(), name, name_less);
+    if (it == g_user_names.end() || *it != name) g_user_names.insert(it, name);
+    if (g_scan_job) g_scan_stale = true;
+}
+void remove_user_name(std::string const& name) {
+    auto it = std::find(g_user_names.begin(), g_user_names.end(), name);
+    if (it != g_user_names.end()) g_user_names.erase(it);
+    if (g_scan_job) g_scan_stale = true;
+}
+
+// list the user songs in the background, a scan that raced with changes to
+// the list is repeated instead of applied
+void scan_user_names() {
+    if (g_scan_job) {
+        g_scan_stale = true;
+        return;
+    }
+    g_scan_stale = false;
+    auto names = std::make_shared<std::vector<std::string>>();
+    g_scan_job = jobs::start(jobs::Priority::Low, [dir = g_song_dir, names](jobs::Token& token) {
+        std::error_code ec;
+        for (auto const& entry : fs::directory_iterator(dir, ec)) {
+            if (token.canceled) return;
+            if (!entry.is_regular_file(ec)) continue;
+            if (entry.path().extension().string() != SNG_SUFFIX) continue;
+            names->emplace_back(entry.path().stem().string());
+        }
+        std::sort(names->begin(), names->end(), name_less);
+    }, [names](jobs::Token&) {
+        g_scan_job = nullptr;
+        if (g_scan_stale) scan_user_names();
+        else g_user_names = std::move(*names);
+    });
+}
+
+void finish_save(std::string const& name, bool ok) {
+    if (!ok) {
+        app::alert("SAVE ERROR");
+        return;
+    }
+    add_user_name(name);
+    song_journal::rebase();
+}
+
+bool is_saving() {
+    return g_save_job != nullptr;
+}
+
 void save() {
-    bool ok = g_song.save((g_song_dir + g_file_name.data() + SNG_SUFFIX).c_str());
-    init();
-    if (!ok) app::alert("SAVE ERROR");
+    if (is_saving()) return;
+    std::string name = g_file_name.data();
+    std::string path = g_song_dir + name + SNG_SUFFIX;
+    // serialize a snapshot in the background, so that a slow storage
+    // doesn't stall the gui and editing can go on meanwhile
+    song_version::Version song = song_version::publish();
+    auto ok = std::make_shared<bool>(false);
+    g_save_job = jobs::start(jobs::Priority::High, [song, path, ok](jobs::Token&) {
+        *ok = song->save(path.c_str());
+    }, [name, ok](jobs::Token&) {
+        g_save_job = nullptr;
+        finish_save(name, *ok);
+    });
 }
 
 void load_demo() {
-    std::vector<uint8_t> buffer;
-    if (!platform::load_asset("songs/" + std::string(g_file_name.data()) + SNG_SUFFIX, buffer)) {
+    platform::Asset asset;
+    if (!platform::load_asset("songs/" + std::string(g_file_name.data()) + SNG_SUFFIX, asset)) {
         app::alert("LOAD ERROR", "Cannot open file");
         return;
     }
     try {
-        g_song.load(buffer.data(), buffer.size());
+        g_song.load(asset.data, asset.size);
     }
     catch (gt::LoadError const& e) {
         g_song.clear();
         app::alert("LOAD ERROR", e.msg);
     }
+    song_version::publish();
     app::player().set_action(gt::Player::Action::Reset);
     song_view::reset();
     song_undo::reset();
+    song_journal::rebase();
 }
 
 void load_user() {
@@ -86,17 +156,39 @@ void load_user() {
         g_song.clear();
         app::alert("LOAD ERROR", e.msg);
     }
+    song_version::publish();
     app::player().set_action(gt::Player::Action::Reset);
     song_view::reset();
     song_undo::reset();
+    song_journal::rebase();
 }
 
 
 #ifndef __EMSCRIPTEN__
-void start_export_thread() {
+void finish_export(std::string const& path, std::string const& name, bool ok) {
+    g_export_job         = nullptr;
+    g_show_export_window = false;
+    if (ok) platform::export_song(path, name);
+}
+
+void start_sng_export() {
+    std::string name = g_file_name.data();
+    std::string path = g_export_dir + name + SNG_SUFFIX;
+    song_version::Version song = song_version::publish();
+    auto ok = std::make_shared<bool>(false);
+    g_export_job = jobs::start(jobs::Priority::High, [song, path, ok](jobs::Token&) {
+        *ok = song->save(path.c_str());
+    }, [path, name, ok](jobs::Token&) {
+        if (!*ok) app::alert("EXPORT ERROR");
+        finish_export(path, name, *ok);
+    });
+}
+
+void start_audio_export() {
     assert(g_export_format != ExportFormat::Sng);
 
-    std::string file_name = g_file_name.data();
+    std::string name      = g_file_name.data();
+    std::string file_name = name;
     assert(file_name != "");
 
     SF_INFO info = { 0, app::MIXRATE, 1 };
@@ -109,7 +201,8 @@ void start_export_thread() {
         file_name += ".wav";
     }
 
-    SNDFILE* sndfile = sf_open((g_export_dir + file_name).c_str(), SFM_WRITE, &info);
+    std::string path = g_export_dir + file_name;
+    SNDFILE* sndfile = sf_open(path.c_str(), SFM_WRITE, &info);
     if (!sndfile) {
         app::alert("EXPORT ERROR", sf_strerror(sndfile));
         g_show_export_window = false;
@@ -119,48 +212,38 @@ void start_export_thread() {
     sf_set_string(sndfile, SF_STR_TITLE, g_song.song_name.data());
     sf_set_string(sndfile, SF_STR_ARTIST, g_song.author_name.data());
 
-    g_export_canceled = false;
-    g_export_done     = false;
-    g_export_progress = 0.0f;
-    g_export_thread = std::thread([sndfile] {
+    // render the song as it is now, with the current mutes, while editing goes on
+    song_version::Version song = song_version::publish();
+    std::array<bool, 3> channel_active;
+    for (int i = 0; i < 3; ++i) channel_active[i] = app::player().is_channel_active(i);
+    int register_write_order = settings_view::settings().register_write_order;
+
+    g_export_job = jobs::start(jobs::Priority::Normal, [sndfile, song, channel_active, register_write_order](jobs::Token& token) {
         std::array<int16_t, 4096> buffer;
 
-        int samples;
-        {
-            // calculate song length in samples
-            gt::Player player{ g_song };
-            player.set_action(gt::Player::Action::Start);
-            uint32_t tick_count = 1;
-            while (player.channel_loop_counter(0) == 0) {
-                player.play_routine();
-                ++tick_count;
-            }
-            tick_count += player.channel_tempo(0);
-            uint32_t const ticks_per_second = g_song.multiplier * 50 ?: 25;
-            uint64_t const cycles_per_tick  = Sid::CLOCKRATE_PAL / ticks_per_second;
-            uint64_t cycles = cycles_per_tick * tick_count;
-            samples = cycles * app::MIXRATE / Sid::CLOCKRATE_PAL;
-        }
+        int samples = song_length(*song);
 
-        gt::Player player{ g_song };
+        gt::Player player{ *song };
         for (int i = 0; i < 3; ++i) {
-            player.set_channel_active(i, app::player().is_channel_active(i));
+            player.set_channel_active(i, channel_active[i]);
         }
         player.set_action(gt::Player::Action::Start);
         Sid sid;
-        sid.init(Sid::Model(g_song.model), Sid::SamplingMethod::ResampleInterpolate);
-        app::Mixer mixer{ player, sid };
+        sid.init(Sid::Model(song->model), Sid::SamplingMethod::ResampleInterpolate);
+        Mixer mixer{ player, sid };
+        mixer.set_register_write_order(register_write_order);
 
-        for(int samples_left = samples; samples_left > 0 && !g_export_canceled;) {
+        for(int samples_left = samples; samples_left > 0 && !token.canceled;) {
             int len = std::min<int>(samples_left, buffer.size());
             samples_left -= len;
             mixer.mix(buffer.data(), len);
             sf_writef_short(sndfile, buffer.data(), len);
-            g_export_progress = float(samples - samples_left) / samples;
+            token.progress = float(samples - samples_left) / samples;
         }
 
         sf_close(sndfile);
-        g_export_done = true;
+    }, [path, name](jobs::Token& token) {
+        finish_export(path, name, !token.canceled);
     });
 }
 #endif
@@ -181,9 +264,11 @@ void import_song(std::string const& path) {
         g_song.clear();
         app::alert("IMPORT ERROR", e.msg);
     }
+    song_version::publish();
     app::player().set_action(gt::Player::Action::Reset);
     song_view::reset();
     song_undo::reset();
+    song_journal::rebase();
 }
 
 void reset() {
@@ -194,8 +279,14 @@ void reset() {
     g_user_names         = {};
     g_file_scroll        = {};
     g_demo_scroll        = {};
+    g_scan_job           = {};
+    g_scan_stale         = {};
+    g_save_job           = {};
     g_show_export_window = {};
     g_export_format      = {};
+#ifndef __EMSCRIPTEN__
+    g_export_job         = {};
+#endif
 }
 
 void init() {
@@ -215,24 +306,14 @@ void init() {
         if (path.extension() != SNG_SUFFIX) continue;
         g_demo_names.emplace_back(path.stem().string());
     }
-    std::sort(g_demo_names.begin(), g_demo_names.end(), [](std::string const& a, std::string const& b) {
-        return strcasecmp(a.c_str(), b.c_str()) < 0;
-    });
+    std::sort(g_demo_names.begin(), g_demo_names.end(), name_less);
 
-    // load user song names
-    g_user_names.clear();
-    for (auto const& entry : fs::directory_iterator(g_song_dir)) {
-        if (!entry.is_regular_file()) continue;
-        if (entry.path().extension().string() != SNG_SUFFIX) continue;
-        g_user_names.emplace_back(entry.path().stem().string());
-    }
-    std::sort(g_user_names.begin(), g_user_names.end(), [](std::string const& a, std::string const& b) {
-        return strcasecmp(a.c_str(), b.c_str()) < 0;
-    });
+    scan_user_names();
 }
 
 
 void draw() {
+
     enum {
         C1 = 12 + 8 * 8,
         C2 = app::CANVAS_WIDTH - C1,
@@ -351,7 +432,7 @@ void draw() {
             });
         }
         gui::same_line();
-        gui::disabled(g_file_name[0] == '\0');
+        gui::disabled(g_file_name[0] == '\0' || is_saving());
         if (gui::button("SAVE")) {
             if (selected) {
                 app::confirm("OVERWRITE THE EXISTING SONG?", [](bool ok) {
@@ -368,7 +449,7 @@ void draw() {
             app::confirm("DELETE SONG?", [](bool ok) {
                 if (!ok) return;
                 fs::remove(g_song_dir + g_file_name.data() + SNG_SUFFIX);
-                init();
+                remove_user_name(g_file_name.data());
             });
         }
 
@@ -392,9 +473,11 @@ void draw() {
             app::confirm("LOSE CHANGES TO THE CURRENT SONG?", [](bool ok) {
                 if (!ok) return;
                 g_song.clear();
+                song_version::publish();
                 app::player().set_action(gt::Player::Action::Reset);
                 song_view::reset();
                 song_undo::reset();
+                song_journal::rebase();
             });
         }
 
@@ -407,7 +490,7 @@ void draw() {
         gui::text("SONG EXPORT");
         gui::separator();
 
-        if (!g_export_thread.joinable()) {
+        if (!g_export_job) {
             gui::choose(box.size.x, nullptr, g_export_format, { "SNG", "WAV", "OGG" });
 
             gui::item_size(box.size.x);
@@ -415,22 +498,14 @@ void draw() {
 
             gui::item_size({ box.size.x / 2, app::BUTTON_HEIGHT });
             if (gui::button("EXPORT")) {
-                if (g_export_format == ExportFormat::Sng) {
-                    std::string path = g_export_dir + g_file_name.data() + SNG_SUFFIX;
-                    bool ok = g_song.save(path.c_str());
-                    if (ok) platform::export_song(path, g_file_name.data());
-                    else app::alert("EXPORT ERROR");
-                    g_show_export_window = false;
-                }
-                else {
-                    start_export_thread();
-                }
+                if (g_export_format == ExportFormat::Sng) start_sng_export();
+                else start_audio_export();
             }
             gui::same_line();
             if (gui::button("CLOSE")) g_show_export_window = false;
         }
         else {
-            // WAV and OGG
+            // export in progress
             gui::item_size({ box.size.x, app::BUTTON_HEIGHT });
             gui::DrawContext& dc = gui::draw_context();
             gui::Box b = gui::item_box();
@@ -438,22 +513,15 @@ void draw() {
             b.pos.y  += 1;
             b.size.x -= 2;
             b.size.y -= 2;
-            b.size.x *= g_export_progress;
+            b.size.x *= g_export_job->progress;
             dc.rgb(color::BUTTON_ACTIVE);
             dc.fill(b);
 
             gui::separator();
-            if (gui::button("CANCEL")) g_export_canceled = true;
-
-            if (g_export_done) {
-                g_export_thread.join();
-                g_show_export_window = false;
-                if (!g_export_canceled) {
-                    std::string path = g_export_dir + g_file_name.data();
-                    path += g_export_format == ExportFormat::Ogg ? ".ogg" : ".wav";
-                    platform::export_song(path, g_file_name.data());
-                }
-            }
+            if (gui::button("CANCEL")) g_export_job->canceled = true;
+
+            // keep the progress bar moving
+            app::request_redraw();
         }
         gui::end_window();
     }
@@ -130,15 +130,30 @@ Filter::Filter()
 
   enable_filter(true);
 
-  // Create mappings from FC to cutoff frequency.
+  // Create mappings from FC to cutoff frequency, once for all instances.
+  // Initialization of the local static is thread safe.
+  static const bool f0_tables_initialized = init_f0_tables();
+  (void) f0_tables_initialized;
+
+  set_chip_model(MOS6581);
+}
+
+
+// ----------------------------------------------------------------------------
+// Shared mappings from FC to cutoff frequency.
+// ----------------------------------------------------------------------------
+sound_sample Filter::f0_6581[2048];
+sound_sample Filter::f0_8580[2048];
+
+bool Filter::init_f0_tables()
+{
   interpolate(f0_points_6581, f0_points_6581
         + sizeof(f0_points_6581)/sizeof(*f0_points_6581) - 1,
         PointPlotter<sound_sample>(f0_6581), 1.0);
   interpolate(f0_points_8580, f0_points_8580
         + sizeof(f0_points_8580)/sizeof(*f0_points_8580) - 1,
         PointPlotter<sound_sample>(f0_8580), 1.0);
-
-  set_chip_model(MOS6581);
+  return true;
 }
 
 
@@ -298,6 +313,7 @@ void Filter::fc_default(const fc_point*& points, int& count)
 // Note that the x range of the interpolation points *must* be [0, 2047],
 // and that additional end points *must* be present since the end points
 // are not interpolated.
+// NB! The FC tables are shared, so a new mapping affects all instances.
 // ----------------------------------------------------------------------------
 PointPlotter<sound_sample> Filter::fc_plotter()
 {
@@ -188,8 +188,10 @@ protected:
 
   // Cutoff frequency tables.
   // FC is an 11 bit register.
-  sound_sample f0_6581[2048];
-  sound_sample f0_8580[2048];
+  // The tables are shared by all Filter instances.
+  static sound_sample f0_6581[2048];
+  static sound_sample f0_8580[2048];
+  static bool init_f0_tables();
   sound_sample* f0;
   static fc_point f0_points_6581[];
   static fc_point f0_points_8580[];
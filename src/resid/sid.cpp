@@ -45,6 +45,8 @@ SID::SID()
   // Initialize pointers.
   sample = 0;
   fir = 0;
+  sample2 = 0;
+  fir2 = 0;
 
   voice[0].set_sync_source(&voice[2]);
   voice[1].set_sync_source(&voice[0]);
@@ -66,6 +68,8 @@ SID::~SID()
 {
   delete[] sample;
   delete[] fir;
+  delete[] sample2;
+  delete[] fir2;
 }
 
 
@@ -454,8 +458,11 @@ bool SID::set_sampling_parameters(double clock_freq, sampling_method method,
           double sample_freq, double pass_freq,
           double filter_scale)
 {
+  bool resample = method == SAMPLE_RESAMPLE_INTERPOLATE ||
+    method == SAMPLE_RESAMPLE_FAST || method == SAMPLE_RESAMPLE_TWOPASS;
+
   // Check resampling constraints.
-  if (method == SAMPLE_RESAMPLE_INTERPOLATE || method == SAMPLE_RESAMPLE_FAST)
+  if (resample)
   {
     // Check whether the sample ring buffer would overfill.
     if (FIR_N*clock_freq/sample_freq >= RINGSIZE) {
@@ -491,24 +498,77 @@ bool SID::set_sampling_parameters(double clock_freq, sampling_method method,
   sample_offset = 0;
   sample_prev = 0;
 
+  delete[] fir;
+  delete[] fir2;
+  delete[] sample2;
+  fir = 0;
+  fir2 = 0;
+  sample2 = 0;
+
   // FIR initialization is only necessary for resampling.
-  if (method != SAMPLE_RESAMPLE_INTERPOLATE && method != SAMPLE_RESAMPLE_FAST)
+  if (!resample)
   {
     delete[] sample;
-    delete[] fir;
     sample = 0;
-    fir = 0;
     return true;
   }
 
+  if (method == SAMPLE_RESAMPLE_TWOPASS) {
+    // Decimate to the intermediate frequency that minimizes the total
+    // filter length, see the comment above clock_resample_interpolate.
+    // The first pass only has to keep aliases out of the passband, so its
+    // transition band is wide and its filter short. Rounding to a whole
+    // decimation factor leaves it with a single filter table.
+    double intermediate_freq = 2*pass_freq +
+      sqrt(2*pass_freq*clock_freq*(sample_freq - 2*pass_freq)/sample_freq);
+    decimation = int(clock_freq/intermediate_freq + 0.5);
+    intermediate_freq = clock_freq/decimation;
+    fir = fir_table(clock_freq, intermediate_freq, pass_freq,
+        intermediate_freq - pass_freq, 1.0, 1, fir_N, fir_RES);
+    fir2 = fir_table(intermediate_freq, sample_freq, pass_freq,
+         sample_freq/2, filter_scale, FIR_RES_INTERPOLATE, fir2_N, fir2_RES);
+    decimation_phase = 0;
+    sample2 = new short[RINGSIZE*2]();
+    sample2_index = 0;
+  }
+  else {
+    int res = method == SAMPLE_RESAMPLE_INTERPOLATE ?
+      FIR_RES_INTERPOLATE : FIR_RES_FAST;
+    fir = fir_table(clock_freq, sample_freq, pass_freq, sample_freq/2,
+        filter_scale, res, fir_N, fir_RES);
+  }
+
+  // Allocate sample buffer.
+  if (!sample) {
+    sample = new short[RINGSIZE*2];
+  }
+  // Clear sample buffer.
+  for (int j = 0; j < RINGSIZE*2; j++) {
+    sample[j] = 0;
+  }
+  sample_index = 0;
+
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Calculate FIR tables for resampling from in_freq to out_freq, with the
+// transition band between pass_freq and stop_freq. Returns res (rounded up
+// to 2^n) tables of N_out samples for the fractional sample offsets.
+// ----------------------------------------------------------------------------
+short* SID::fir_table(double in_freq, double out_freq, double pass_freq,
+          double stop_freq, double filter_scale, int res,
+          int& N_out, int& RES_out)
+{
   const double pi = 3.1415926535897932385;
 
   // 16 bits -> -96dB stopband attenuation.
   const double A = -20*log10(1.0/(1 << 16));
   // A fraction of the bandwidth is allocated to the transition band,
-  double dw = (1 - 2*pass_freq/sample_freq)*pi;
+  double dw = 2*(stop_freq - pass_freq)/out_freq*pi;
   // The cutoff frequency is midway through the transition band.
-  double wc = (2*pass_freq/sample_freq + 1)*pi/2;
+  double wc = (pass_freq + stop_freq)/out_freq*pi;
 
   // For calculation of beta and N see the reference for the kaiserord
   // function in the MATLAB Signal Processing Toolbox:
@@ -523,24 +583,21 @@ bool SID::set_sampling_parameters(double clock_freq, sampling_method method,
   int N = int((A - 7.95)/(2.285*dw) + 0.5);
   N += N & 1;
 
-  double f_samples_per_cycle = sample_freq/clock_freq;
-  double f_cycles_per_sample = clock_freq/sample_freq;
+  double f_samples_per_cycle = out_freq/in_freq;
+  double f_cycles_per_sample = in_freq/out_freq;
 
   // The filter length is equal to the filter order + 1.
   // The filter length must be an odd number (sinc is symmetric about x = 0).
-  fir_N = int(N*f_cycles_per_sample) + 1;
+  int fir_N = int(N*f_cycles_per_sample) + 1;
   fir_N |= 1;
 
   // We clamp the filter table resolution to 2^n, making the fixpoint
   // sample_offset a whole multiple of the filter table resolution.
-  int res = method == SAMPLE_RESAMPLE_INTERPOLATE ?
-    FIR_RES_INTERPOLATE : FIR_RES_FAST;
   int n = (int)ceil(log(res/f_cycles_per_sample)/log(2));
-  fir_RES = 1 << n;
+  int fir_RES = n > 0 ? 1 << n : 1;
 
   // Allocate memory for FIR tables.
-  delete[] fir;
-  fir = new short[fir_N*fir_RES];
+  short* fir = new short[fir_N*fir_RES];
 
   // Calculate fir_RES FIR tables for linear interpolation.
   for (int i = 0; i < fir_RES; i++) {
@@ -562,17 +619,9 @@ bool SID::set_sampling_parameters(double clock_freq, sampling_method method,
     }
   }
 
-  // Allocate sample buffer.
-  if (!sample) {
-    sample = new short[RINGSIZE*2];
-  }
-  // Clear sample buffer.
-  for (int j = 0; j < RINGSIZE*2; j++) {
-    sample[j] = 0;
-  }
-  sample_index = 0;
-
-  return true;
+  N_out = fir_N;
+  RES_out = fir_RES;
+  return fir;
 }
 
 
@@ -756,6 +805,8 @@ int SID::clock(cycle_count& delta_t, short* buf, int n, int interleave)
     return clock_resample_interpolate(delta_t, buf, n, interleave);
   case SAMPLE_RESAMPLE_FAST:
     return clock_resample_fast(delta_t, buf, n, interleave);
+  case SAMPLE_RESAMPLE_TWOPASS:
+    return clock_resample_twopass(delta_t, buf, n, interleave);
   }
 }
 
@@ -1022,3 +1073,125 @@ int SID::clock_resample_fast(cycle_count& delta_t, short* buf, int n,
   delta_t = 0;
   return s;
 }
+
+
+// ----------------------------------------------------------------------------
+// Clock one cycle for two-pass resampling. Every decimation cycles the
+// first pass produces an intermediate sample, in which case true is returned.
+// ----------------------------------------------------------------------------
+RESID_INLINE
+bool SID::clock_decimate()
+{
+  clock();
+  sample[sample_index] = sample[sample_index + RINGSIZE] = output();
+  ++sample_index;
+  sample_index &= 0x3fff;
+  if (++decimation_phase < decimation) {
+    return false;
+  }
+  decimation_phase = 0;
+
+  // Convolution with filter impulse response.
+  short* sample_start = sample + sample_index - fir_N + RINGSIZE;
+  int v = 0;
+  for (int j = 0; j < fir_N; j++) {
+    v += sample_start[j]*fir[j];
+  }
+  v >>= FIR_SHIFT;
+
+  // Saturated arithmetics to guard against 16 bit sample overflow.
+  const int half = 1 << 15;
+  if (v >= half) {
+    v = half - 1;
+  }
+  else if (v < -half) {
+    v = -half;
+  }
+
+  sample2[sample2_index] = sample2[sample2_index + RINGSIZE] = v;
+  ++sample2_index;
+  sample2_index &= 0x3fff;
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// SID clocking with audio sampling - cycle based with two-pass audio
+// resampling.
+//
+// The first pass decimates the cycle samples by an integer factor. Its
+// transition band reaches up to where aliases would fold back into the
+// passband, so its filter is short and needs a single table. The second
+// pass resamples the intermediate samples like clock_resample_interpolate,
+// with a filter that is long in samples but short in time. Together they
+// take a fraction of the convolution work of one pass at the cycle rate.
+//
+// ----------------------------------------------------------------------------
+RESID_INLINE
+int SID::clock_resample_twopass(cycle_count& delta_t, short* buf, int n,
+        int interleave)
+{
+  int s = 0;
+
+  for (;;) {
+    cycle_count next_sample_offset = sample_offset + cycles_per_sample;
+    cycle_count delta_t_sample = next_sample_offset >> FIXP_SHIFT;
+    if (delta_t_sample > delta_t) {
+      break;
+    }
+    if (s >= n) {
+      return s;
+    }
+    for (int i = 0; i < delta_t_sample; i++) {
+      clock_decimate();
+    }
+    delta_t -= delta_t_sample;
+    sample_offset = next_sample_offset & FIXP_MASK;
+
+    // Second pass, as in clock_resample_interpolate, with the offset from
+    // the last intermediate sample counted in intermediate samples.
+    int offset = ((decimation_phase << FIXP_SHIFT) + sample_offset)/decimation;
+    int fir_offset = offset*fir2_RES >> FIXP_SHIFT;
+    int fir_offset_rmd = offset*fir2_RES & FIXP_MASK;
+    short* fir_start = fir2 + fir_offset*fir2_N;
+    short* sample_start = sample2 + sample2_index - fir2_N + RINGSIZE;
+
+    int v1 = 0;
+    for (int j = 0; j < fir2_N; j++) {
+      v1 += sample_start[j]*fir_start[j];
+    }
+
+    if (++fir_offset == fir2_RES) {
+      fir_offset = 0;
+      --sample_start;
+    }
+    fir_start = fir2 + fir_offset*fir2_N;
+
+    int v2 = 0;
+    for (int j = 0; j < fir2_N; j++) {
+      v2 += sample_start[j]*fir_start[j];
+    }
+
+    int v = v1 + (fir_offset_rmd*(v2 - v1) >> FIXP_SHIFT);
+
+    v >>= FIR_SHIFT;
+
+    // Saturated arithmetics to guard against 16 bit sample overflow.
+    const int half = 1 << 15;
+    if (v >= half) {
+      v = half - 1;
+    }
+    else if (v < -half) {
+      v = -half;
+    }
+
+    buf[s++*interleave] = v;
+  }
+
+  for (int i = 0; i < delta_t; i++) {
+    clock_decimate();
+  }
+  sample_offset -= delta_t << FIXP_SHIFT;
+  delta_t = 0;
+  return s;
+}
@@ -87,6 +87,9 @@ public:
 
 protected:
   static double I0(double x);
+  static short* fir_table(double in_freq, double out_freq, double pass_freq,
+        double stop_freq, double filter_scale, int res,
+        int& N_out, int& RES_out);
   RESID_INLINE int clock_fast(cycle_count& delta_t, short* buf, int n,
             int interleave);
   RESID_INLINE int clock_interpolate(cycle_count& delta_t, short* buf, int n,
@@ -95,6 +98,9 @@ protected:
                 int n, int interleave);
   RESID_INLINE int clock_resample_fast(cycle_count& delta_t, short* buf,
                int n, int interleave);
+  RESID_INLINE int clock_resample_twopass(cycle_count& delta_t, short* buf,
+            int n, int interleave);
+  RESID_INLINE bool clock_decimate();
 
   Voice voice[3];
   Filter filter;
@@ -124,6 +130,17 @@ protected:
 
   // FIR_RES filter tables (FIR_N*FIR_RES).
   short* fir;
+
+  // Two-pass resampling: the first pass decimates by an integer factor
+  // with the single filter table above, the second pass resamples the
+  // intermediate samples with these.
+  int decimation;
+  int decimation_phase;
+  int sample2_index;
+  int fir2_N;
+  int fir2_RES;
+  short* sample2;
+  short* fir2;
 };
 
 #endif // not __SID_H__
@@ -50,7 +50,8 @@ typedef sound_sample fc_point[2];
 enum chip_model { MOS6581 = 1, MOS8580 };
 
 enum sampling_method { SAMPLE_FAST, SAMPLE_INTERPOLATE,
-           SAMPLE_RESAMPLE_INTERPOLATE, SAMPLE_RESAMPLE_FAST };
+           SAMPLE_RESAMPLE_INTERPOLATE, SAMPLE_RESAMPLE_FAST,
+           SAMPLE_RESAMPLE_TWOPASS };
 
 extern "C"
 {
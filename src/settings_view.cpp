@@ -1,7 +1,9 @@
 #include "settings_view.hpp"
 #include "app.hpp"
+#include "gtcompact.hpp"
 #include "piano.hpp"
 #include "platform.hpp"
+#include "profiler.hpp"
 
 namespace settings_view {
 namespace {
@@ -63,6 +65,7 @@ void draw() {
         "INTERPOLATE",
         "RESAMPLE INTERPOLATE",
         "RESAMPLE FAST",
+        "RESAMPLE TWO PASS",
     };
 
     gui::button_style(gui::ButtonStyle::Tab);
@@ -104,6 +107,14 @@ void draw() {
         }
         gui::item_size({ app::CANVAS_WIDTH, app::BUTTON_HEIGHT });
 
+        // merge duplicates and drop unused data, this can be undone
+        if (gui::button("COMPACT SONG")) {
+            app::player().set_action(gt::Player::Action::Stop);
+            gt::CompactReport r = gt::compact(g_song);
+            sprintf(str, "%zu -> %zu BYTES", r.size_before, r.size_after);
+            app::alert("SONG COMPACTED", str);
+        }
+
     }
     else if (mode == Mode::Editor) {
         if (gui::choose(app::CANVAS_WIDTH, "FULLSCREEN     ", g_settings.fullscreen_enabled)) {
@@ -126,15 +137,25 @@ void draw() {
         if (gui::button(SAMPLING_LABELS[g_settings.sampling_method])) {
             window = Window::SamplingMethod;
         }
+
+        gui::item_size({ app::CANVAS_WIDTH, app::BUTTON_HEIGHT });
+        // the light engine is much cheaper than reSID, for slow devices
+        gui::choose(app::CANVAS_WIDTH, "SID ENGINE     ", g_settings.sid_engine, { "RESID", "LIGHT" });
+        gui::choose(app::CANVAS_WIDTH, "PROFILER       ", g_settings.profiler_overlay);
+        if (g_settings.profiler_overlay && gui::button("EXPORT TRACE")) {
+            std::string path = app::storage_dir() + "/trace.json";
+            if (profiler::export_trace(path)) app::alert("TRACE EXPORTED", "trace.json");
+            else app::alert("TRACE EXPORT FAILED");
+        }
     }
 
 
     if (window == Window::SamplingMethod) {
-        gui::Box box = gui::begin_window({ app::CANVAS_WIDTH - 48, app::BUTTON_HEIGHT * 6 + gui::FRAME_WIDTH * 2 });
+        gui::Box box = gui::begin_window({ app::CANVAS_WIDTH - 48, app::BUTTON_HEIGHT * 7 + gui::FRAME_WIDTH * 2 });
         gui::item_size({ box.size.x, app::BUTTON_HEIGHT });
         gui::text("SAMPLING METHOD");
         gui::separator();
-        for (int i = 0; i < 4; ++i) {
+        for (int i = 0; i < 5; ++i) {
             if (gui::button(SAMPLING_LABELS[i], i == g_settings.sampling_method)) {
                 g_settings.sampling_method = i;
                 window = Window::None;
@@ -7,7 +7,9 @@
     X(row_highlight,        int,  8) \
     X(row_height,           int,  15) \
     X(sampling_method,      int,  3) \
-    X(register_write_order, int,  1)
+    X(sid_engine,           int,  0) \
+    X(register_write_order, int,  1) \
+    X(profiler_overlay,     bool, false)
 
 
 namespace settings_view {
@@ -16,10 +16,14 @@
 #include "resid/wave.cpp"
 
 #include "sid.hpp"
+#include "lite_sid.hpp"
 
 
 struct Sid::Impl {
-    SID sid;
+    SID                     sid;
+    LiteSid                 lite;
+    Engine                  engine = Engine::ReSid;
+    std::array<uint8_t, 25> regs   = {};
 };
 
 Sid::Sid() = default;
@@ -28,32 +32,58 @@ Sid::Sid(Sid&&) noexcept = default;
 Sid& Sid::operator=(Sid&&) noexcept = default;
 
 
-void Sid::init(Model model, SamplingMethod sampling_method) {
+void Sid::init(Model model, SamplingMethod sampling_method, Engine engine) {
     if (!impl) impl = std::make_unique<Impl>();
+    impl->engine = engine;
     reset();
     set_chip_model(model);
     set_sampling_method(sampling_method);
-    impl->sid.clock(10000); // clock some cycles to surpress the initial clicking
+    clock(10000); // clock some cycles to surpress the initial clicking
 }
 void Sid::reset() {
     impl->sid.reset();
+    impl->lite.reset();
+    impl->regs = {};
 }
 void Sid::set_chip_model(Model model) {
     impl->sid.set_chip_model(model == Model::MOS6581 ? MOS6581 : MOS8580);
+    impl->lite.set_chip_model(model);
 }
 void Sid::set_sampling_method(SamplingMethod sampling_method) {
     impl->sid.set_sampling_parameters(CLOCKRATE_PAL, ::sampling_method(sampling_method), MIXRATE);
 }
 
+// the new engine starts from the registers written so far
+void Sid::set_engine(Engine engine) {
+    if (impl->engine == engine) return;
+    impl->engine = engine;
+    impl->sid.reset();
+    impl->lite.reset();
+    for (int r = 0; r < int(impl->regs.size()); ++r) {
+        if (engine == Engine::Lite) impl->lite.write(r, impl->regs[r]);
+        else impl->sid.write(r, impl->regs[r]);
+    }
+}
+
 void Sid::set_reg(int reg, uint8_t value) {
-    impl->sid.write(reg, value);
+    impl->regs[reg] = value;
+    if (impl->engine == Engine::Lite) impl->lite.write(reg, value);
+    else impl->sid.write(reg, value);
 }
 
 int Sid::clock(int cycles, int16_t* buffer, int length) {
+    if (impl->engine == Engine::Lite) return impl->lite.clock(cycles, buffer, length);
     return impl->sid.clock(cycles, buffer, length);
 }
 
+// advance the chip without producing samples, bypassing the resampler
+void Sid::clock(int cycles) {
+    if (impl->engine == Engine::Lite) impl->lite.clock(cycles);
+    else impl->sid.clock(cycles);
+}
+
 std::array<float, 3> Sid::get_env_levels() {
+    if (impl->engine == Engine::Lite) return impl->lite.get_env_levels();
     SID::State state = impl->sid.read_state();
     std::array<float, 3> levels = {};
     for (int c = 0; c < 3; ++c) {
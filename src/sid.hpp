@@ -17,18 +17,23 @@ public:
         Interpolate,
         ResampleInterpolate,
         ResampleFast,
+        ResampleTwoPass,
     };
+    // reSID, or the cheaper LiteSid approximation
+    enum class Engine { ReSid, Lite };
 
     Sid();
     ~Sid();
     Sid(Sid&&) noexcept;
     Sid& operator=(Sid&&) noexcept;
-    void                 init(Model model, SamplingMethod sampling_method);
+    void                 init(Model model, SamplingMethod sampling_method, Engine engine = Engine::ReSid);
     void                 reset();
     void                 set_chip_model(Model model);
     void                 set_sampling_method(SamplingMethod sampling_method);
+    void                 set_engine(Engine engine);
     void                 set_reg(int reg, uint8_t value);
     int                  clock(int cycles, int16_t* buffer, int length);
+    void                 clock(int cycles);
     std::array<float, 3> get_env_levels();
 private:
     struct Impl;
@@ -0,0 +1,90 @@
+#include "song_changes.hpp"
+
+#include "app.hpp"
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <type_traits>
+
+
+namespace song_changes {
+namespace {
+
+static_assert(std::is_trivially_copyable<gt::Song>::value, "songs are compared as raw bytes");
+
+gt::Song& g_song = app::song();
+gt::Song  g_last; // the song as of the last update
+bool      g_valid = false;
+
+
+// a deque keeps references to its elements valid as it grows
+std::deque<Changes>& subscribers() {
+    static std::deque<Changes> subscribers;
+    return subscribers;
+}
+
+// whether any block that overlaps the member changed
+template <class T>
+bool changed(std::bitset<BLOCK_COUNT> const& blocks, T const& member) {
+    size_t offset = (uint8_t const*) &member - (uint8_t const*) &g_song;
+    size_t first  = offset / BLOCK_SIZE;
+    size_t last   = (offset + sizeof(T) - 1) / BLOCK_SIZE;
+    for (size_t b = first; b <= last; ++b) {
+        if (blocks[b]) return true;
+    }
+    return false;
+}
+
+} // namespace
+
+
+Changes& subscribe() {
+    subscribers().emplace_back();
+    return subscribers().back();
+}
+
+void update() {
+    PROFILE_SCOPE("song_changes::update");
+    Changes changes;
+    if (!g_valid) {
+        g_valid = true;
+        g_last  = g_song;
+        changes.blocks.set();
+    }
+    else {
+        if (memcmp(&g_last, &g_song, sizeof(gt::Song)) == 0) return;
+        uint8_t*       a = (uint8_t*) &g_last;
+        uint8_t const* b = (uint8_t const*) &g_song;
+        for (size_t i = 0; i < BLOCK_COUNT; ++i) {
+            size_t pos = i * BLOCK_SIZE;
+            size_t n   = std::min<size_t>(BLOCK_SIZE, sizeof(gt::Song) - pos);
+            if (memcmp(a + pos, b + pos, n) == 0) continue;
+            memcpy(a + pos, b + pos, n);
+            changes.blocks.set(i);
+        }
+    }
+
+    // blocks can straddle two parts, which then both count as changed
+    for (int i = 0; i < gt::MAX_PATT; ++i) {
+        if (changed(changes.blocks, g_song.patterns[i])) changes.patterns.set(i);
+    }
+    for (int t = 0; t < gt::MAX_TABLES; ++t) {
+        changes.tables[t] = changed(changes.blocks, g_song.ltable[t]) || changed(changes.blocks, g_song.rtable[t]);
+    }
+    changes.instruments = changed(changes.blocks, g_song.instruments);
+    changes.orders      = changed(changes.blocks, g_song.song_order) ||
+                          changed(changes.blocks, g_song.song_len) ||
+                          changed(changes.blocks, g_song.song_loop);
+
+    for (Changes& s : subscribers()) {
+        s.blocks      |= changes.blocks;
+        s.patterns    |= changes.patterns;
+        for (int t = 0; t < gt::MAX_TABLES; ++t) s.tables[t] |= changes.tables[t];
+        s.instruments |= changes.instruments;
+        s.orders      |= changes.orders;
+    }
+}
+
+} // namespace song_changes
@@ -0,0 +1,30 @@
+#pragma once
+#include "gtsong.hpp"
+#include <bitset>
+
+// Finds what changed in app::song(), so the modules that follow the song
+// don't each have to keep a copy and compare it every frame. update keeps
+// the one copy, compares it with the song block by block, and adds the
+// changes to every subscriber's set. Subscribers look at their set when
+// they sync and clear it once they've caught up.
+namespace song_changes {
+
+enum {
+    BLOCK_SIZE  = 32,
+    BLOCK_COUNT = (sizeof(gt::Song) + BLOCK_SIZE - 1) / BLOCK_SIZE,
+};
+
+struct Changes {
+    std::bitset<BLOCK_COUNT>          blocks;      // changed byte ranges of the song, BLOCK_SIZE each
+    std::bitset<gt::MAX_PATT>         patterns;
+    std::array<bool, gt::MAX_TABLES>  tables      = {}; // left or right column
+    bool                              instruments = false;
+    bool                              orders      = false; // order lists, song length or loop
+
+    bool any() const { return blocks.any(); }
+};
+
+Changes& subscribe(); // a new change set, fine to call during static initialization
+void     update();    // UI thread: find the changes since the last update, once per frame or before using the song
+
+} // namespace song_changes
@@ -0,0 +1,150 @@
+#include "song_index.hpp"
+
+#include "app.hpp"
+#include "gtsong.hpp"
+#include "profiler.hpp"
+#include "song_changes.hpp"
+
+
+namespace song_index {
+namespace {
+
+gt::Song&              g_song    = app::song();
+song_changes::Changes& g_changes = song_changes::subscribe();
+bool                   g_valid   = false;
+
+std::array<bool, gt::MAX_PATT> g_pattern_empty;
+std::set<int>                  g_empty_patterns;
+std::array<int, gt::MAX_PATT>  g_pattern_refs;
+
+// per pattern counts, so a changed pattern can take back its old counts
+gt::Array2<uint16_t, gt::MAX_PATT, gt::MAX_INSTR>     g_pattern_instr_refs;
+std::array<int, gt::MAX_INSTR>                        g_instrument_refs;
+gt::Array2<uint8_t, gt::MAX_TABLES, gt::MAX_TABLELEN> g_table_owner;
+gt::Array2<uint8_t, gt::MAX_TABLES, gt::MAX_TABLELEN> g_table_users;
+
+
+bool is_empty(gt::Pattern const& patt) {
+    for (int r = 0; r < patt.len; ++r) {
+        gt::PatternRow row = patt.rows[r];
+        if (row.note != gt::REST || row.instr || row.command) return false;
+    }
+    return true;
+}
+
+void index_pattern(int i) {
+    gt::Pattern const& patt = g_song.patterns[i];
+    g_pattern_empty[i] = is_empty(patt);
+    if (g_pattern_empty[i]) g_empty_patterns.insert(i);
+    else g_empty_patterns.erase(i);
+
+    // instruments are referenced by the instrument column and by table ptr commands
+    auto& refs = g_pattern_instr_refs[i];
+    for (int n = 0; n < gt::MAX_INSTR; ++n) g_instrument_refs[n] -= refs[n];
+    refs = {};
+    for (int r = 0; r < patt.len; ++r) {
+        gt::PatternRow row = patt.rows[r];
+        if (row.instr > 0 && row.instr < gt::MAX_INSTR) ++refs[row.instr];
+        if (row.command >= gt::CMD_SETWAVEPTR && row.command <= gt::CMD_SETFILTERPTR &&
+            row.data > 0 && row.data < gt::MAX_INSTR)
+        {
+            ++refs[row.data];
+        }
+    }
+    for (int n = 0; n < gt::MAX_INSTR; ++n) g_instrument_refs[n] += refs[n];
+}
+
+void index_orders() {
+    g_pattern_refs = {};
+    for (auto const& order : g_song.song_order) {
+        for (int r = 0; r < g_song.song_len; ++r) {
+            if (order[r].pattnum < gt::MAX_PATT) ++g_pattern_refs[order[r].pattnum];
+        }
+    }
+}
+
+void index_tables() {
+    g_table_owner = {};
+    g_table_users = {};
+    for (int t = 0; t < gt::MAX_TABLES; ++t) {
+        for (int i = 1; i < gt::MAX_INSTR; ++i) {
+            int start = g_song.instruments[i].ptr[t] - 1;
+            if (start < 0) continue;
+            ++g_table_users[t][start];
+            // the part ends with its jump row
+            int end = start;
+            if (t != gt::STBL) {
+                while (end < gt::MAX_TABLELEN - 1 && g_song.ltable[t][end] != 0xff) ++end;
+            }
+            for (int r = start; r <= end; ++r) {
+                if (g_table_owner[t][r] == 0) g_table_owner[t][r] = i;
+            }
+        }
+    }
+}
+
+bool tables_changed() {
+    if (g_changes.instruments) return true;
+    for (bool t : g_changes.tables) {
+        if (t) return true;
+    }
+    return false;
+}
+
+} // namespace
+
+
+void reset() {
+    g_valid = false;
+}
+
+void sync() {
+    PROFILE_SCOPE("song_index::sync");
+    if (!g_valid) {
+        g_valid   = true;
+        g_changes = {};
+        g_pattern_instr_refs = {};
+        g_instrument_refs    = {};
+        for (int i = 0; i < gt::MAX_PATT; ++i) index_pattern(i);
+        index_orders();
+        index_tables();
+        return;
+    }
+    if (!g_changes.any()) return;
+    for (int i = 0; i < gt::MAX_PATT; ++i) {
+        if (g_changes.patterns[i]) index_pattern(i);
+    }
+    if (g_changes.orders) index_orders();
+    if (tables_changed()) index_tables();
+    g_changes = {};
+}
+
+bool pattern_empty(int patt) {
+    return g_pattern_empty[patt];
+}
+
+std::set<int> const& empty_patterns() {
+    return g_empty_patterns;
+}
+
+int pattern_refs(int patt) {
+    return g_pattern_refs[patt];
+}
+
+int instrument_refs(int instr) {
+    return g_instrument_refs[instr];
+}
+
+int instrument_refs(int instr, int patt) {
+    return g_pattern_instr_refs[patt][instr];
+}
+
+int table_row_owner(int table, int row) {
+    return g_table_owner[table][row];
+}
+
+int table_part_users(int table, int start_row) {
+    return g_table_users[table][start_row];
+}
+
+} // namespace song_index
@@ -0,0 +1,20 @@
+#pragma once
+#include <set>
+
+// Keeps track of which patterns, instruments and table rows the song uses.
+// Each sync only re-indexes the parts that song_changes reports as changed,
+// so queries are cheap enough to make while drawing.
+namespace song_index {
+
+void reset(); // forget everything, the next sync rebuilds the index
+void sync();  // catch up with the changes found by the last song_changes::update
+
+bool                 pattern_empty(int patt);
+std::set<int> const& empty_patterns();
+int                  pattern_refs(int patt);                     // order rows that play the pattern
+int                  instrument_refs(int instr);                 // pattern rows that use the instrument
+int                  instrument_refs(int instr, int patt);       // rows of the pattern that use the instrument
+int                  table_row_owner(int table, int row);        // first instrument whose table part has the row, or 0
+int                  table_part_users(int table, int start_row); // instruments that point to the table part
+
+} // namespace song_index
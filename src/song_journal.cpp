@@ -0,0 +1,286 @@
+#include "song_journal.hpp"
+
+#include "app.hpp"
+#include "gtsong.hpp"
+#include "log.hpp"
+#include "mapped_file.hpp"
+#include "song_changes.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+
+namespace song_journal {
+
+#ifndef __EMSCRIPTEN__
+namespace {
+
+static_assert(std::is_trivially_copyable<gt::Song>::value, "songs are journaled as raw bytes");
+
+enum {
+    MAX_JOURNAL_SIZE = 1 << 20,
+    FLUSH_INTERVAL   = 1000, // milliseconds between fsyncs
+};
+
+constexpr char MAGIC[4] = { 'G', 'T', 'J', '2' };
+
+// bump when a member of gt::Song changes type or meaning without moving
+constexpr uint32_t LAYOUT_VERSION = 1;
+
+// file layout: MAGIC, uint32 song layout, then records.
+// The first record covers the whole song and is the base for the others.
+struct RecordHeader {
+    uint32_t offset;
+    uint32_t length;
+    uint32_t checksum;
+};
+
+gt::Song&               g_song    = app::song();
+song_changes::Changes&  g_changes = song_changes::subscribe(); // blocks not yet recorded
+std::string             g_path;
+size_t                  g_journal_size;
+
+// shared with the writer thread
+std::thread             g_thread;
+std::mutex              g_mutex;
+std::condition_variable g_cond;
+std::vector<uint8_t>    g_pending;    // records to append
+std::vector<uint8_t>    g_new_file;   // replaces the journal if not empty
+bool                    g_quit;
+
+
+uint32_t checksum(uint32_t offset, uint32_t length, uint8_t const* data) {
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    auto add = [&h](uint8_t b) { h = (h ^ b) * 16777619u; };
+    for (int i = 0; i < 4; ++i) add(offset >> i * 8);
+    for (int i = 0; i < 4; ++i) add(length >> i * 8);
+    for (uint32_t i = 0; i < length; ++i) add(data[i]);
+    return h;
+}
+
+// Hashes the version and where gt::Song and its parts keep their members, so
+// a journal from a build with another layout is never replayed into this one.
+uint32_t song_layout() {
+    uint32_t h = 2166136261u;
+    auto add = [&h](size_t v) {
+        for (int i = 0; i < 4; ++i) h = (h ^ uint8_t(v >> i * 8)) * 16777619u;
+    };
+#define MEMBER(T, m) add(offsetof(T, m)); add(sizeof(T::m))
+    add(LAYOUT_VERSION);
+    add(sizeof(gt::Song));
+    MEMBER(gt::Song, instruments);
+    MEMBER(gt::Song, ltable);
+    MEMBER(gt::Song, rtable);
+    MEMBER(gt::Song, song_order);
+    MEMBER(gt::Song, patterns);
+    MEMBER(gt::Song, song_len);
+    MEMBER(gt::Song, song_loop);
+    MEMBER(gt::Song, song_name);
+    MEMBER(gt::Song, author_name);
+    MEMBER(gt::Song, copyright_name);
+    MEMBER(gt::Song, adparam);
+    MEMBER(gt::Song, multiplier);
+    MEMBER(gt::Song, model);
+    MEMBER(gt::Instrument, ad);
+    MEMBER(gt::Instrument, sr);
+    MEMBER(gt::Instrument, ptr);
+    MEMBER(gt::Instrument, vibdelay);
+    MEMBER(gt::Instrument, gatetimer);
+    MEMBER(gt::Instrument, firstwave);
+    MEMBER(gt::Instrument, name);
+    MEMBER(gt::OrderRow, trans);
+    MEMBER(gt::OrderRow, pattnum);
+    MEMBER(gt::PatternRow, note);
+    MEMBER(gt::PatternRow, instr);
+    MEMBER(gt::PatternRow, command);
+    MEMBER(gt::PatternRow, data);
+    MEMBER(gt::Pattern, rows);
+    MEMBER(gt::Pattern, len);
+#undef MEMBER
+    return h;
+}
+
+// Checksums only catch torn writes, so check that the song can be played
+// before it replaces the current one.
+bool is_playable(gt::Song const& song) {
+    if (song.song_len < 1 || song.song_len > gt::MAX_SONG_ROWS) return false;
+    if (song.song_loop < 0 || song.song_loop >= song.song_len) return false;
+    if (song.model != gt::Model::MOS6581 && song.model != gt::Model::MOS8580) return false;
+    for (auto const& order : song.song_order) {
+        for (int r = 0; r < song.song_len; ++r) {
+            if (order[r].pattnum >= gt::MAX_PATT) return false;
+        }
+    }
+    for (gt::Pattern const& patt : song.patterns) {
+        if (patt.len < 1 || patt.len > gt::MAX_PATTROWS) return false;
+        for (gt::PatternRow const& row : patt.rows) {
+            if (row.instr >= gt::MAX_INSTR || row.command > gt::CMD_SETTEMPO) return false;
+        }
+    }
+    return true;
+}
+
+void append_record(std::vector<uint8_t>& buf, uint32_t offset, uint32_t length) {
+    uint8_t const* data = (uint8_t const*) &g_song + offset;
+    RecordHeader h = { offset, length, checksum(offset, length, data) };
+    buf.insert(buf.end(), (uint8_t const*) &h, (uint8_t const*) (&h + 1));
+    buf.insert(buf.end(), data, data + length);
+}
+
+void writer() {
+    std::unique_lock<std::mutex> lock(g_mutex);
+    for (;;) {
+        g_cond.wait(lock, [] { return g_quit || !g_pending.empty() || !g_new_file.empty(); });
+        // collect more edits so there's only one fsync per batch
+        g_cond.wait_for(lock, std::chrono::milliseconds(FLUSH_INTERVAL), [] { return g_quit; });
+        std::vector<uint8_t> new_file;
+        std::vector<uint8_t> pending;
+        new_file.swap(g_new_file);
+        pending.swap(g_pending);
+        bool quit = g_quit;
+        lock.unlock();
+
+        if (!new_file.empty()) {
+            if (!write_file_atomic(g_path.c_str(), new_file.data(), new_file.size())) {
+                LOGE("song_journal: could not write %s", g_path.c_str());
+                // records for the new base must not end up on the old one
+                remove(g_path.c_str());
+            }
+        }
+        if (!pending.empty() && !write_file(g_path.c_str(), "ab", pending.data(), pending.size())) {
+            LOGE("song_journal: could not append to %s", g_path.c_str());
+        }
+
+        lock.lock();
+        if (quit && g_pending.empty() && g_new_file.empty()) break;
+    }
+}
+
+bool restore() {
+    // the writer thread isn't running yet, so the file can't change under the mapping
+    MappedFile buf;
+    if (!buf.open(g_path.c_str())) return false;
+
+    uint32_t layout;
+    if (buf.size() < 8 || memcmp(buf.data(), MAGIC, 4) != 0) return false;
+    memcpy(&layout, buf.data() + 4, 4);
+    if (layout != song_layout()) {
+        LOGW("song_journal: journal is from a different version");
+        return false;
+    }
+
+    static gt::Song song;
+    size_t pos   = 8;
+    int    count = 0;
+    while (pos + sizeof(RecordHeader) <= buf.size()) {
+        RecordHeader h;
+        memcpy(&h, buf.data() + pos, sizeof(h));
+        pos += sizeof(h);
+        // a torn write at the end of the journal is expected after a crash
+        if (h.offset > sizeof(gt::Song) || h.length > sizeof(gt::Song) - h.offset) break;
+        if (h.length > buf.size() - pos) break;
+        if (checksum(h.offset, h.length, buf.data() + pos) != h.checksum) break;
+        if (count == 0 && h.length != sizeof(gt::Song)) break;
+        memcpy((uint8_t*) &song + h.offset, buf.data() + pos, h.length);
+        pos += h.length;
+        ++count;
+    }
+    if (count == 0) return false;
+    if (!is_playable(song)) {
+        LOGW("song_journal: journal holds a broken song");
+        return false;
+    }
+    g_song = song;
+    LOGI("song_journal: restored song with %d edits", count - 1);
+    return true;
+}
+
+} // namespace
+
+
+void init() {
+    g_path = app::storage_dir() + "/autosave.journal";
+    restore();
+    g_quit   = false;
+    g_thread = std::thread(writer);
+    rebase();
+}
+
+void free() {
+    if (!g_thread.joinable()) return;
+    song_changes::update();
+    sync();
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        g_quit = true;
+    }
+    g_cond.notify_one();
+    g_thread.join();
+}
+
+void rebase() {
+    if (!g_thread.joinable()) return;
+    g_changes = {};
+    std::vector<uint8_t> buf(MAGIC, MAGIC + 4);
+    uint32_t layout = song_layout();
+    buf.insert(buf.end(), (uint8_t const*) &layout, (uint8_t const*) (&layout + 1));
+    append_record(buf, 0, sizeof(gt::Song));
+    g_journal_size = buf.size();
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        g_new_file.swap(buf);
+        g_pending.clear(); // superseded by the new base
+    }
+    g_cond.notify_one();
+}
+
+void sync() {
+    if (!g_thread.joinable()) return;
+    if (!g_changes.any()) return;
+
+    // one record per run of changed blocks
+    std::vector<uint8_t> records;
+    size_t start = 0;
+    bool   in_range = false;
+    for (size_t i = 0; i < song_changes::BLOCK_COUNT; ++i) {
+        bool changed = g_changes.blocks[i];
+        if (changed && !in_range) start = i * song_changes::BLOCK_SIZE;
+        if (!changed && in_range) append_record(records, start, i * song_changes::BLOCK_SIZE - start);
+        in_range = changed;
+    }
+    if (in_range) append_record(records, start, sizeof(gt::Song) - start);
+    g_changes = {};
+
+    // compact the journal when it gets big
+    g_journal_size += records.size();
+    if (g_journal_size > MAX_JOURNAL_SIZE) {
+        rebase();
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        g_pending.insert(g_pending.end(), records.begin(), records.end());
+    }
+    g_cond.notify_one();
+}
+
+#else
+// no threads and no persistent storage on the web
+
+void init() {}
+void free() {}
+void sync() {}
+void rebase() {}
+
+#endif
+
+} // namespace song_journal
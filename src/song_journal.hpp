@@ -0,0 +1,13 @@
+#pragma once
+
+// Crash safe autosave. Edits are appended to a journal file as byte ranges
+// of the song that changed, on top of a snapshot taken at the last load or
+// save. On startup the snapshot is restored and the journal replayed.
+namespace song_journal {
+
+void init();   // restore the song of the previous session and start journaling
+void free();
+void sync();   // record the changes found by song_changes since the last sync
+void rebase(); // start a new journal, e.g. after the song was loaded or saved
+
+} // namespace song_journal
@@ -3,9 +3,11 @@
 #include "app.hpp"
 #include "gtsong.hpp"
 #include "log.hpp"
+#include "profiler.hpp"
+#include "song_changes.hpp"
 
+#include <algorithm>
 #include <array>
-#include <cstring>
 
 
 namespace song_undo {
@@ -13,18 +15,16 @@ namespace {
 
 constexpr int MAX_LEVELS = 64;
 
-gt::Song& g_song = app::song();
+gt::Song&              g_song    = app::song();
+song_changes::Changes& g_changes = song_changes::subscribe();
 
-std::array<gt::Song, MAX_LEVELS> g_undo;
-std::array<gt::Song, MAX_LEVELS> g_redo;
-int                              g_undo_size = 0;
-int                              g_redo_size = 0;
-gt::Song                         g_anchor;
-bool                             g_anchor_valid = false;
-
-bool equals(gt::Song const& a, gt::Song const& b) {
-    return std::memcmp(&a, &b, sizeof(a)) == 0;
-}
+// snapshots share unchanged patterns, tables and instruments with each other
+std::array<gt::SongSnapshot, MAX_LEVELS> g_undo;
+std::array<gt::SongSnapshot, MAX_LEVELS> g_redo;
+int                                      g_undo_size = 0;
+int                                      g_redo_size = 0;
+gt::SongSnapshot                         g_anchor;
+bool                                     g_anchor_valid = false;
 
 } // namespace
 
@@ -32,19 +32,27 @@ void reset() {
     g_undo_size    = 0;
     g_redo_size    = 0;
     g_anchor_valid = false;
+    // release the blocks of the old song
+    g_undo         = {};
+    g_redo         = {};
+    g_anchor       = {};
 }
 
 void sync() {
+    PROFILE_SCOPE("song_undo::sync");
     if (!g_anchor_valid) {
         g_anchor_valid = true;
-        g_anchor       = g_song;
+        g_anchor       = gt::SongSnapshot(g_song);
+        g_changes      = {};
     }
 
-    if (equals(g_anchor, g_song)) return;
+    if (!g_changes.any()) return;
+    g_changes = {};
+    if (g_anchor == g_song) return;
 
-    if (g_undo_size == 0 || !equals(g_undo[g_undo_size - 1], g_anchor)) {
+    if (g_undo_size == 0 || g_undo[g_undo_size - 1] != g_anchor) {
         if (g_undo_size >= MAX_LEVELS) {
-            for (int i = 1; i < MAX_LEVELS; ++i) g_undo[i - 1] = g_undo[i];
+            std::move(g_undo.begin() + 1, g_undo.end(), g_undo.begin());
             g_undo[MAX_LEVELS - 1] = g_anchor;
         }
         else {
@@ -52,35 +60,40 @@ void sync() {
         }
     }
     g_redo_size = 0;
-    g_anchor    = g_song;
+    g_anchor    = gt::SongSnapshot(g_song, &g_anchor);
 }
 
 void undo() {
     while (g_undo_size > 0) {
-        gt::Song const& prev = g_undo[--g_undo_size];
-        if (equals(prev, g_song)) continue;
-        g_redo[g_redo_size++] = g_song;
-        g_anchor = g_song = prev;
+        gt::SongSnapshot const& prev = g_undo[--g_undo_size];
+        if (prev == g_song) continue;
+        g_redo[g_redo_size++] = gt::SongSnapshot(g_song, &g_anchor);
+        prev.restore(g_song);
+        g_anchor = prev;
         return;
     }
 }
 
 void redo() {
     while (g_redo_size > 0) {
-        gt::Song const& next = g_redo[--g_redo_size];
-        if (equals(next, g_song)) continue;
-        g_undo[g_undo_size++] = g_song;
-        g_anchor = g_song = next;
+        gt::SongSnapshot const& next = g_redo[--g_redo_size];
+        if (next == g_song) continue;
+        g_undo[g_undo_size++] = gt::SongSnapshot(g_song, &g_anchor);
+        next.restore(g_song);
+        g_anchor = next;
         return;
     }
 }
 
+// Neighbouring levels always differ, and so do the anchor and the levels next
+// to it. Without changes since the last sync the song is the anchor, so the
+// song only needs to be compared if it changed.
 bool can_undo() {
-    return g_undo_size > 0 && !equals(g_undo[g_undo_size - 1], g_song);
+    return g_undo_size > 0 && (!g_changes.any() || g_undo[g_undo_size - 1] != g_song);
 }
 
 bool can_redo() {
-    return g_redo_size > 0 && !equals(g_redo[g_redo_size - 1], g_song);
+    return g_redo_size > 0 && (!g_changes.any() || g_redo[g_redo_size - 1] != g_song);
 }
 
 } // namespace song_undo
@@ -0,0 +1,48 @@
+#include "song_version.hpp"
+
+#include "app.hpp"
+#include "song_changes.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+
+namespace song_version {
+namespace {
+
+gt::Song&              g_song    = app::song();
+song_changes::Changes& g_changes = song_changes::subscribe();
+Version                g_latest;  // only accessed with std::atomic_load and std::atomic_store
+std::vector<Version>   g_retired; // replaced versions that readers may still hold
+
+} // namespace
+
+
+Version publish() {
+    // A retired version can't be pinned again, so once we hold the last reference it's free.
+    // use_count is a relaxed load, so fence before freeing to see the reader's last accesses.
+    auto free = std::remove_if(g_retired.begin(), g_retired.end(), [](Version const& v) {
+        return v.use_count() == 1;
+    });
+    if (free != g_retired.end()) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        g_retired.erase(free, g_retired.end());
+    }
+
+    // this is the once per frame update the other modules catch up with
+    song_changes::update();
+    Version latest = std::atomic_load(&g_latest);
+    if (latest && !g_changes.any()) return latest;
+    g_changes = {};
+    Version version = std::make_shared<gt::Song const>(g_song);
+    std::atomic_store(&g_latest, version);
+    if (latest) g_retired.push_back(std::move(latest));
+    return version;
+}
+
+Version pin() {
+    return std::atomic_load(&g_latest);
+}
+
+} // namespace song_version
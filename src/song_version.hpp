@@ -0,0 +1,17 @@
+#pragma once
+#include "gtsong.hpp"
+#include <memory>
+
+// Immutable versions of the song for the audio and export threads. The
+// editor keeps changing app::song() in place and publishes it once per
+// frame. A reader pins a version and sees a consistent song for as long as
+// it holds on to it, no matter what the editor does meanwhile. Old versions
+// are freed by publish once no reader holds them, so readers never free.
+namespace song_version {
+
+using Version = std::shared_ptr<gt::Song const>;
+
+Version publish(); // UI thread only: publish the song if it changed, returns the latest version
+Version pin();     // any thread: the latest published version, or null before the first publish
+
+} // namespace song_version
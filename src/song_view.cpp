@@ -9,6 +9,8 @@
 #include "piano.hpp"
 #include "settings_view.hpp"
 #include "sid.hpp"
+#include "song_changes.hpp"
+#include "song_index.hpp"
 
 #include <array>
 #include <cstddef>
@@ -24,6 +26,139 @@ enum {
     CC = 84,
 };
 
+// note names with octave, e.g. "C#3", using the sharp glyphs of the font
+struct NoteName {
+    char glyphs[3];
+};
+constexpr std::array<NoteName, gt::LASTNOTE - gt::FIRSTNOTE + 1> make_note_names() {
+    std::array<NoteName, gt::LASTNOTE - gt::FIRSTNOTE + 1> names = {};
+    for (int n = 0; n < int(names.size()); ++n) {
+        names[n].glyphs[0] = "CCDDEFFGGAAB"[n % 12];
+        // "-#-#--#-#-#-"
+        names[n].glyphs[1] = "\x12\x13\x12\x13\x12\x12\x13\x12\x13\x12\x13\x12"[n % 12];
+        names[n].glyphs[2] = '0' + n / 12;
+    }
+    return names;
+}
+constexpr auto NOTE_NAMES = make_note_names();
+
+
+// draw the text of a pattern cell
+void draw_pattern_cell(gui::DrawContext& dc, ivec2 t, gt::PatternRow const& row) {
+    dc.rgb(color::WHITE);
+    if (row.note == gt::REST) {
+        dc.rgb(color::DARK_GREY);
+        dc.glyphs(t, "\x01\x01\x01", 3);
+    }
+    else if (row.note == gt::KEYOFF) {
+        dc.glyphs(t, "\x0a\x0b\x0c", 3);
+    }
+    else if (row.note == gt::KEYON) {
+        dc.glyphs(t, "\x0d\x0e\x0f", 3);
+    }
+    else {
+        dc.glyphs(t, NOTE_NAMES[row.note - gt::FIRSTNOTE].glyphs, 3);
+    }
+    t.x += 28;
+
+    if (row.instr > 0) {
+        dc.rgb(color::INSTRUMENT);
+        dc.hex(t, row.instr, 2);
+    }
+    t.x += 20;
+
+    if (row.command > 0) {
+        dc.rgb(color::CMDS[row.command]);
+        uint8_t data = row.data;
+        if (data > 0 && row.command == gt::CMD_VIBRATO)   data -= gt::STBL_VIB_START;
+        if (data > 0 && row.command == gt::CMD_FUNKTEMPO) data -= gt::STBL_FUNK_START;
+        dc.hex(t, row.command, 1);
+        dc.hex(t + ivec2(8, 0), data, 2);
+    }
+}
+
+
+// Off-screen cache of the pattern text, one slot per channel. A slot is
+// only re-rendered when the content of its pattern or the row height
+// changes. Scrolling merely moves the source rectangle.
+class PatternCache {
+public:
+    void free() {
+        m_canvas.free();
+        for (Slot& slot : m_slots) slot.valid = false;
+    }
+
+    void update(int c, gt::Pattern const& patt, int row_height) {
+        // two columns per slot keep the texture within 2048 pixels
+        int h = 2;
+        while (h < COLUMN_ROWS * row_height) h *= 2;
+        if (m_canvas.size().y != h) {
+            m_canvas.init({ WIDTH, h });
+            for (Slot& slot : m_slots) slot.valid = false;
+        }
+
+        Slot& slot = m_slots[c];
+        if (slot.valid && slot.row_height == row_height &&
+            memcmp(&slot.pattern, &patt, sizeof(patt)) == 0) return;
+        slot.valid      = true;
+        slot.row_height = row_height;
+        slot.pattern    = patt;
+
+        gfx::Mesh        mesh;
+        gui::DrawContext dc;
+        dc.mesh(mesh);
+        dc.rgb(0);
+        dc.alpha(0);
+        for (int i = 0; i < COLUMNS_PER_SLOT; ++i) {
+            dc.fill({ { (c * COLUMNS_PER_SLOT + i) * CC, 0 }, { CC, h } });
+        }
+        dc.alpha(255);
+        int text_offset = (row_height - 7) / 2;
+        for (int r = 0; r < patt.len; ++r) {
+            draw_pattern_cell(dc, row_pos(c, r, row_height) + ivec2(1 + 5, text_offset), patt.rows[r]);
+        }
+
+        // glyphs don't overlap, so no blending is needed and the fill clears the slot
+        gfx::Canvas const* target = gfx::current_canvas();
+        gfx::canvas(m_canvas);
+        gfx::blend(false);
+        gfx::draw(mesh, gui::atlas());
+        gfx::blend(true);
+        if (target) gfx::canvas(*target);
+        else gfx::reset_canvas();
+    }
+
+    // draw rows [begin, end) of a slot with the first row at pos
+    void draw(int c, ivec2 pos, int begin, int end, int row_height) {
+        Slot const& slot = m_slots[c];
+        end = std::min(end, slot.pattern.len);
+        while (begin < end) {
+            int n = std::min(end, (begin / COLUMN_ROWS + 1) * COLUMN_ROWS) - begin;
+            gui::texture_rect(m_canvas, { pos, { CC, n * row_height } }, row_pos(c, begin, row_height));
+            pos.y += n * row_height;
+            begin += n;
+        }
+    }
+
+private:
+    enum {
+        WIDTH            = 512,
+        COLUMN_ROWS      = gt::MAX_PATTROWS / 2,
+        COLUMNS_PER_SLOT = 2,
+    };
+    static ivec2 row_pos(int c, int r, int row_height) {
+        return { (c * COLUMNS_PER_SLOT + r / COLUMN_ROWS) * CC, r % COLUMN_ROWS * row_height };
+    }
+
+    struct Slot {
+        bool        valid;
+        int         row_height;
+        gt::Pattern pattern;
+    };
+    std::array<Slot, gt::MAX_CHN> m_slots;
+    gfx::Canvas                   m_canvas;
+};
+
 enum class EditMode {
     Song,
     SongMark,
@@ -35,6 +170,7 @@ enum class EditMode {
 
 gt::Song&                      g_song = app::song();
 int                            g_song_page;
+PatternCache                   g_pattern_cache;
 bool                           g_recording;
 EditMode                       g_edit_mode;
 int                            g_song_scroll;
@@ -50,7 +186,6 @@ int                            g_mark_row;
 bool                           g_show_order_edit_window;
 bool                           g_show_pattern_edit_window;
 int                            g_drag_pattern;
-std::array<bool, gt::MAX_PATT> g_pattern_empty;
 std::array<bool, gt::MAX_PATT> g_pattern_marked;
 
 
@@ -62,17 +197,17 @@ struct SongCopyBuffer {
 
 void shuffle_patterns(size_t i, size_t j) {
     if (i == j) return;
-    // init mapping
+    // move pattern i to j, in place so no copy of all patterns is needed
     std::array<uint8_t, gt::MAX_PATT> mapping;
     for (int n = 0; n < gt::MAX_PATT; ++n) mapping[n] = n;
+    auto& patterns = g_song.patterns;
     if (i < j) {
         std::rotate(mapping.begin() + i, mapping.begin() + j, mapping.begin() + j + 1);
+        std::rotate(patterns.begin() + i, patterns.begin() + i + 1, patterns.begin() + j + 1);
     } else if (i > j) {
         std::rotate(mapping.begin() + j, mapping.begin() + j + 1, mapping.begin() + i + 1);
+        std::rotate(patterns.begin() + j, patterns.begin() + i, patterns.begin() + i + 1);
     }
-    // apply mapping
-    auto copy = g_song.patterns;
-    for (int n = 0; n < gt::MAX_PATT; ++n) g_song.patterns[mapping[n]] = copy[n];
     for (auto& o : g_song.song_order) {
         for (gt::OrderRow& row : o) {
             row.pattnum = mapping[row.pattnum];
@@ -80,19 +215,6 @@ void shuffle_patterns(size_t i, size_t j) {
     }
 }
 
-void check_empty_patterns() {
-    for (int i = 0; i < gt::MAX_PATT; ++i) {
-        g_pattern_empty[i] = true;
-        gt::Pattern const& patt = g_song.patterns[i];
-        for (int r = 0; r < patt.len; ++r) {
-            auto row = patt.rows[r];
-            if (row.note != gt::REST || row.instr || row.command) {
-                g_pattern_empty[i] = false;
-                break;
-            }
-        }
-    }
-}
 void check_marked_patterns() {
     g_pattern_marked = {};
     int mark_row_min  = std::min(g_mark_row, g_cursor_song_row);
@@ -128,7 +250,6 @@ void clamp_view_state() {
 void init_order_edit() {
     g_show_order_edit_window = true;
     g_transpose = g_song.song_order[g_cursor_chan][g_cursor_song_row].trans;
-    check_empty_patterns();
 
     if (g_edit_mode != EditMode::SongMark) {
         g_mark_row  = g_cursor_song_row;
@@ -181,13 +302,14 @@ void draw_order_edit() {
             g_drag_pattern = pos.x + pos.y * 8;
             if (prev_pattern != g_drag_pattern) {
                 shuffle_patterns(prev_pattern, g_drag_pattern);
-                check_empty_patterns();
+                song_changes::update();
+                song_index::sync();
                 check_marked_patterns();
             }
             if (gui::touch::just_released()) g_drag_pattern = -1;
         }
         else {
-            gui::button_style(g_pattern_empty[i] ? gui::ButtonStyle::Shaded : gui::ButtonStyle::Normal);
+            gui::button_style(song_index::pattern_empty(i) ? gui::ButtonStyle::Shaded : gui::ButtonStyle::Normal);
             if (gui::button(str, g_pattern_marked[i])) {
                 int mark_row_min  = std::min(g_mark_row, g_cursor_song_row);
                 int mark_row_max  = std::max(g_mark_row, g_cursor_song_row);
@@ -274,6 +396,22 @@ int cursor_instrument() {
     return g_cursor_instr;
 }
 
+bool show_pattern(int patt) {
+    for (int r = 0; r < g_song.song_len; ++r) {
+        for (int c = 0; c < gt::MAX_CHN; ++c) {
+            if (g_song.song_order[c][r].pattnum != patt) continue;
+            g_edit_mode          = EditMode::Pattern;
+            g_cursor_chan        = c;
+            g_cursor_song_row    = r;
+            g_cursor_pattern_row = 0;
+            g_song_scroll        = r - g_song_page / 2;
+            g_pattern_scroll     = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
 void reset() {
     g_song_page                = 8;
     g_recording                = false;
@@ -288,6 +426,7 @@ void reset() {
     g_show_order_edit_window   = false;
     g_show_pattern_edit_window = false;
     g_drag_pattern             = -1;
+    g_pattern_cache.free();
 }
 
 bool get_follow() {
@@ -368,9 +507,8 @@ void draw() {
         gui::item_size({ CN, settings.row_height });
         gui::Box box = gui::item_box();
 
-        sprintf(str, "%02X", r);
         dc.rgb(color::ROW_NUMBER);
-        dc.text(box.pos + ivec2(6, text_offset), str);
+        dc.hex(box.pos + ivec2(6, text_offset), r, 2);
 
         gui::item_size({ CC, settings.row_height });
         for (int c = 0; c < 3; ++c) {
@@ -438,14 +576,13 @@ void draw() {
                 dc.box(box, gui::BoxStyle::Cursor);
             }
 
-            sprintf(str, "   %c%X", "+-"[row.trans < 0], abs(row.trans));
             int prev_trans = r == 0 ? 0 : g_song.song_order[c][r - 1].trans;
             dc.rgb(row.trans == prev_trans ? color::DARK_GREY : color::WHITE);
-            dc.text(box.pos + ivec2(5, text_offset), str);
+            dc.glyphs(box.pos + ivec2(5 + 3 * 8, text_offset), &"+-"[row.trans < 0], 1);
+            dc.hex(box.pos + ivec2(5 + 4 * 8, text_offset), abs(row.trans), abs(row.trans) < 0x10 ? 1 : 2);
 
-            sprintf(str, "%02X", row.pattnum);
             dc.rgb(color::WHITE);
-            dc.text(box.pos + ivec2(5, text_offset), str);
+            dc.hex(box.pos + ivec2(5, text_offset), row.pattnum, 2);
         }
 
         // loop marker
@@ -477,6 +614,9 @@ void draw() {
         // dc.rgb(color::mix(color::GREEN, 0, 0.2f));
         dc.rgb(color::mix(color::C64[11], 0, 0.2f));
         dc.fill({ p + ivec2(29, 13), ivec2(levels[c] * 46.0f + 0.9f, 4) });
+        // keep animating until the envelope has decayed.
+        // during playback the frame pacing redraws often enough.
+        if (levels[c] > 0.0f && !player.is_playing()) app::request_redraw();
     }
 
     gui::cursor({ 0, gui::cursor().y + 1 }); // 1px padding
@@ -487,20 +627,21 @@ void draw() {
     }
 
     // patterns
+    std::array<ivec2, 3> pattern_text_pos = {};
     for (int i = 0; i < pattern_page; ++i) {
         int r = g_pattern_scroll + i;
 
         gui::item_size({ CN, settings.row_height });
         gui::Box box = gui::item_box();
 
-        sprintf(str, "%02X", r);
         dc.rgb(color::ROW_NUMBER);
-        dc.text(box.pos + ivec2(6, text_offset), str);
+        dc.hex(box.pos + ivec2(6, text_offset), r, 2);
 
         gui::item_size({ CC, settings.row_height });
         for (int c = 0; c < 3; ++c) {
             gui::same_line();
             gui::Box box = gui::item_box();
+            if (i == 0) pattern_text_pos[c] = box.pos;
             gt::Pattern& patt = g_song.patterns[patt_nums[c]];
             if (r >= patt.len) continue;
             gt::PatternRow& row = patt.rows[r];
@@ -568,45 +709,14 @@ void draw() {
                 dc.rgb(color::BUTTON_PRESSED);
                 dc.box(box, gui::BoxStyle::Cursor);
             }
-
-            ivec2 t = box.pos + ivec2(5, text_offset);
-            dc.rgb(color::WHITE);
-            if (row.note == gt::REST) {
-                dc.rgb(color::DARK_GREY);
-                dc.text(t, "\x01\x01\x01");
-            }
-            else if (row.note == gt::KEYOFF) {
-                dc.text(t, "\x0a\x0b\x0c");
-            }
-            else if (row.note == gt::KEYON) {
-                dc.text(t, "\x0d\x0e\x0f");
-            }
-            else {
-                sprintf(str, "%c%c%d", "CCDDEFFGGAAB"[row.note % 12],
-                             // "-#-#--#-#-#-"
-                             "\x12\x13\x12\x13\x12\x12\x13\x12\x13\x12\x13\x12"[row.note % 12],
-                             (row.note - gt::FIRSTNOTE) / 12);
-                dc.text(t, str);
-            }
-            t.x += 28;
-
-            if (row.instr > 0) {
-                sprintf(str, "%02X", row.instr);
-                dc.rgb(color::INSTRUMENT);
-                dc.text(t, str);
-            }
-            t.x += 20;
-
-            if (row.command > 0) {
-                dc.rgb(color::CMDS[row.command]);
-                uint8_t data = row.data;
-                if (data > 0 && row.command == gt::CMD_VIBRATO)   data -= gt::STBL_VIB_START;
-                if (data > 0 && row.command == gt::CMD_FUNKTEMPO) data -= gt::STBL_FUNK_START;
-                sprintf(str, "%X%02X", row.command, data);
-                dc.text(t, str);
-            }
         }
     }
+    // pattern text
+    dc.rgb(color::WHITE);
+    for (int c = 0; c < 3; ++c) {
+        g_pattern_cache.update(c, g_song.patterns[patt_nums[c]], settings.row_height);
+        g_pattern_cache.draw(c, pattern_text_pos[c], g_pattern_scroll, g_pattern_scroll + pattern_page, settings.row_height);
+    }
     gui::cursor({ 0, gui::cursor().y + 1 });
     gui::item_size(app::CANVAS_WIDTH);
     gui::separator();
@@ -761,17 +871,15 @@ void draw() {
         if (g_show_pattern_edit_window) {
             gui::Box box = gui::begin_window({ app::CANVAS_WIDTH - 12, app::BUTTON_HEIGHT * 5 + gui::FRAME_WIDTH * 2 });
             gui::item_size({ box.size.x, app::BUTTON_HEIGHT });
-            gui::text("PATTERN %02X", patt_nums[g_cursor_chan]);
+            gui::text("PATTERN %02X, %d ORDER ROWS", patt_nums[g_cursor_chan], song_index::pattern_refs(patt_nums[g_cursor_chan]));
             gui::separator();
             gui::slider(box.size.x, "LENGTH %02X", patt.len, 1, gt::MAX_PATTROWS);
             g_cursor_pattern_row = std::min(g_cursor_pattern_row, patt.len - 1);
             gui::item_size({ box.size.x, app::BUTTON_HEIGHT });
             if (gui::button("RESIZE EMPTY PATTERNS")) {
-                check_empty_patterns();
-                for (int i = 0; i < gt::MAX_PATT; ++i) {
-                    if (!g_pattern_empty[i]) continue;
-                    g_song.patterns[i].len = patt.len;
-                }
+                song_changes::update();
+                song_index::sync();
+                for (int i : song_index::empty_patterns()) g_song.patterns[i].len = patt.len;
             }
             gui::item_size({ box.size.x / 2, app::BUTTON_HEIGHT });
             gui::disabled(patt.len <= 1);
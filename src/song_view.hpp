@@ -5,6 +5,7 @@ namespace song_view {
     int  channel();
     int  song_position();
     int  cursor_instrument();
+    bool show_pattern(int patt); // move the cursor to the first order row that plays the pattern
     void reset();
     void draw();
     void draw_pattern();
@@ -0,0 +1,243 @@
+#include "table_space.hpp"
+
+#include "app.hpp"
+#include "gtsong.hpp"
+#include "song_changes.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+
+namespace table_space {
+namespace {
+
+struct TableIndex {
+    std::array<bool, gt::MAX_TABLELEN> used;
+    std::vector<Extent>                free;
+    int                                length;
+    int                                free_rows;
+};
+
+gt::Song&                              g_song    = app::song();
+song_changes::Changes&                 g_changes = song_changes::subscribe();
+bool                                   g_valid   = false;
+
+std::array<TableIndex, gt::MAX_TABLES> g_index;
+
+// last row of the table part, which is its jump row
+int part_end(int table, int start) {
+    auto const& ltable = g_song.ltable[table];
+    int end = start;
+    while (end < gt::MAX_TABLELEN - 1 && ltable[end] != 0xff) ++end;
+    return end;
+}
+
+void index_table(int t) {
+    TableIndex& index = g_index[t];
+    index.used = {};
+    if (t == gt::STBL) {
+        // speed table rows are referenced by commands, so keep every row that's set
+        for (int r = 0; r < gt::MAX_TABLELEN; ++r) {
+            index.used[r] = g_song.ltable[t][r] | g_song.rtable[t][r];
+        }
+    }
+    else {
+        for (gt::Instrument const& instr : g_song.instruments) {
+            int start = instr.ptr[t] - 1;
+            if (start < 0) continue;
+            int end = part_end(t, start);
+            std::fill(index.used.begin() + start, index.used.begin() + end + 1, true);
+        }
+    }
+
+    index.free.clear();
+    index.length    = 0;
+    index.free_rows = 0;
+    for (int r = 0; r < gt::MAX_TABLELEN; ++r) {
+        if (index.used[r]) {
+            index.length = r + 1;
+            continue;
+        }
+        ++index.free_rows;
+        if (!index.free.empty() && index.free.back().start + index.free.back().len == r) {
+            ++index.free.back().len;
+        }
+        else {
+            index.free.push_back({ r, 1 });
+        }
+    }
+}
+
+// Moves the used rows to the start of the table.
+// Returns the new position of each row, or -1 for dropped rows.
+std::array<int, gt::MAX_TABLELEN> pack(int t) {
+    TableIndex const& index = g_index[t];
+    std::array<int, gt::MAX_TABLELEN> new_row;
+    std::array<uint8_t, gt::MAX_TABLELEN> ltable = {};
+    std::array<uint8_t, gt::MAX_TABLELEN> rtable = {};
+    int n = 0;
+    for (int r = 0; r < gt::MAX_TABLELEN; ++r) {
+        if (!index.used[r]) {
+            new_row[r] = -1;
+            continue;
+        }
+        new_row[r] = n;
+        ltable[n]  = g_song.ltable[t][r];
+        rtable[n]  = g_song.rtable[t][r];
+        ++n;
+    }
+
+    // jumps stay inside their table part, so their target is never dropped
+    for (int r = 0; r < n; ++r) {
+        if (ltable[r] == 0xff && rtable[r] > 0 && new_row[rtable[r] - 1] >= 0) {
+            rtable[r] = new_row[rtable[r] - 1] + 1;
+        }
+    }
+    // the wave table's pointer commands refer to instruments, not rows, so they stay as they are
+    for (gt::Instrument& instr : g_song.instruments) {
+        if (instr.ptr[t] > 0) instr.ptr[t] = new_row[instr.ptr[t] - 1] + 1;
+    }
+    g_song.ltable[t] = ltable;
+    g_song.rtable[t] = rtable;
+    index_table(t);
+    return new_row;
+}
+
+int find_free_run(int t, int len) {
+    for (Extent const& e : g_index[t].free) {
+        if (e.len >= len) return e.start;
+    }
+    return -1;
+}
+
+} // namespace
+
+
+void reset() {
+    g_valid = false;
+}
+
+void sync() {
+    if (!g_valid || g_changes.instruments) {
+        g_valid   = true;
+        g_changes = {};
+        for (int t = 0; t < gt::MAX_TABLES; ++t) index_table(t);
+        return;
+    }
+    if (!g_changes.any()) return;
+    for (int t = 0; t < gt::MAX_TABLES; ++t) {
+        if (g_changes.tables[t]) index_table(t);
+    }
+    g_changes = {};
+}
+
+int length(int table) {
+    return g_index[table].length;
+}
+
+int free_rows(int table) {
+    return g_index[table].free_rows;
+}
+
+std::vector<Extent> const& free_extents(int table) {
+    return g_index[table].free;
+}
+
+int alloc(int table, int len) {
+    assert(table != gt::STBL);
+    // the caller may have edited the song since the last update
+    song_changes::update();
+    sync();
+    if (len > g_index[table].free_rows) return -1;
+    int start = find_free_run(table, len);
+    if (start >= 0) return start;
+    pack(table);
+    return find_free_run(table, len);
+}
+
+void release(int table, int instr) {
+    assert(table != gt::STBL);
+    song_changes::update();
+    sync();
+    int start = g_song.instruments[instr].ptr[table] - 1;
+    if (start < 0) return;
+    int end = part_end(table, start);
+    g_song.instruments[instr].ptr[table] = 0;
+    index_table(table);
+    // clear rows unless another instrument's part still uses them
+    for (int r = start; r <= end; ++r) {
+        if (g_index[table].used[r]) continue;
+        g_song.ltable[table][r] = 0;
+        g_song.rtable[table][r] = 0;
+    }
+    index_table(table);
+}
+
+int insert_row(int table, int pos) {
+    assert(table != gt::STBL);
+    song_changes::update();
+    sync();
+    TableIndex const& index = g_index[table];
+    if (index.free_rows == 0) return -1;
+    auto hole = std::find(index.used.begin() + pos, index.used.end(), false);
+    if (hole == index.used.end()) {
+        // all free rows are above pos
+        pos  = pack(table)[pos];
+        hole = std::find(index.used.begin() + pos, index.used.end(), false);
+    }
+    int end = hole - index.used.begin();
+
+    for (gt::Instrument& instr : g_song.instruments) {
+        if (instr.ptr[table] > pos + 1 && instr.ptr[table] <= end) ++instr.ptr[table];
+    }
+    auto& ltable = g_song.ltable[table];
+    auto& rtable = g_song.rtable[table];
+    for (int i = pos; i < end; ++i) {
+        if (ltable[i] == 0xff && rtable[i] >= pos + 1) ++rtable[i];
+    }
+    std::rotate(ltable.begin() + pos, ltable.begin() + end, ltable.begin() + end + 1);
+    std::rotate(rtable.begin() + pos, rtable.begin() + end, rtable.begin() + end + 1);
+    ltable[pos] = 0;
+    rtable[pos] = 0;
+    index_table(table);
+    return pos;
+}
+
+void delete_row(int table, int pos) {
+    assert(table != gt::STBL);
+    song_changes::update();
+    sync();
+    TableIndex const& index = g_index[table];
+    auto& ltable = g_song.ltable[table];
+    auto& rtable = g_song.rtable[table];
+    int end = std::find(index.used.begin() + pos, index.used.end(), false) - index.used.begin() - 1;
+    end = std::max(end, pos);
+
+    // deleting the jump row deletes the table part
+    bool is_jump_row = ltable[pos] == 0xff;
+    for (gt::Instrument& instr : g_song.instruments) {
+        if (is_jump_row && instr.ptr[table] == pos + 1) {
+            instr.ptr[table] = 0;
+        }
+        else if (instr.ptr[table] > pos + 1 && instr.ptr[table] <= end + 1) {
+            --instr.ptr[table];
+        }
+    }
+    for (int i = pos + 1; i <= end; ++i) {
+        if (ltable[i] == 0xff && rtable[i] > pos + 1) --rtable[i];
+    }
+    std::rotate(ltable.begin() + pos, ltable.begin() + pos + 1, ltable.begin() + end + 1);
+    std::rotate(rtable.begin() + pos, rtable.begin() + pos + 1, rtable.begin() + end + 1);
+    ltable[end] = 0;
+    rtable[end] = 0;
+    index_table(table);
+}
+
+void defragment(int table) {
+    assert(table != gt::STBL);
+    song_changes::update();
+    sync();
+    pack(table);
+}
+
+} // namespace table_space
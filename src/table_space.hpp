@@ -0,0 +1,44 @@
+#pragma once
+#include <vector>
+
+// Keeps track of which rows of the wave, pulse and filter tables belong to
+// instrument table parts. New parts go into the first free run that fits,
+// so rows freed in the middle of a table get reused, and the table is only
+// defragmented when no run is long enough. Like song_index, queries are
+// answered from an index that each sync brings up to date.
+namespace table_space {
+
+struct Extent {
+    int start;
+    int len;
+};
+
+void reset(); // forget everything, the next sync rebuilds the index
+void sync();  // catch up with the changes found by the last song_changes::update
+
+int                        length(int table);    // rows up to and including the last used one
+int                        free_rows(int table); // unused rows anywhere in the table
+std::vector<Extent> const& free_extents(int table);
+
+// Returns the first row of a free run of len rows, defragmenting the table
+// if needed, or -1 if there's not enough space.
+int  alloc(int table, int len);
+
+// Clears the instrument's table pointer and frees the rows of its table
+// part that no other instrument uses.
+void release(int table, int instr);
+
+// Inserts an empty row at pos, shifting rows down only as far as the next
+// free row. Returns where the new row ended up, which differs from pos if
+// the table had to be defragmented, or -1 if the table is full.
+int  insert_row(int table, int pos);
+
+// Deletes the row at pos, shifting rows up only as far as the end of the
+// used run. Deleting a jump row clears the pointers to its table part.
+void delete_row(int table, int pos);
+
+// Moves all table parts to the start of the table, fixing instrument
+// pointers and jumps. Rows that no table part uses are dropped.
+void defragment(int table);
+
+} // namespace table_space
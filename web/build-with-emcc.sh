@@ -13,15 +13,26 @@ emcc \
     ../src/gfx.cpp \
     ../src/app.cpp \
     ../src/command_edit.cpp \
+    ../src/gtcompact.cpp \
     ../src/gtplayer.cpp \
     ../src/gtsong.cpp \
     ../src/gui.cpp \
     ../src/instrument_view.cpp \
     ../src/instrument_manager_view.cpp \
+    ../src/jobs.cpp \
+    ../src/lite_sid.cpp \
+    ../src/mapped_file.cpp \
+    ../src/mixer.cpp \
     ../src/piano.cpp \
+    ../src/profiler.cpp \
     ../src/project_view.cpp \
     ../src/settings_view.cpp \
     ../src/sid.cpp \
+    ../src/song_changes.cpp \
+    ../src/song_index.cpp \
+    ../src/song_journal.cpp \
     ../src/song_undo.cpp \
+    ../src/song_version.cpp \
     ../src/song_view.cpp \
+    ../src/table_space.cpp \
     -o index.html